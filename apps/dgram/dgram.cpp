@@ -26,11 +26,13 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <yocto/ext/json.hpp>
 #include <yocto/yocto_cli.h>
 #include <yocto/yocto_image.h>
 #include <yocto/yocto_math.h>
 #include <yocto_dgram/yocto_dgram.h>
 #include <yocto_dgram/yocto_dgram_bvh.h>
+#include <yocto_dgram/yocto_dgram_export.h>
 #include <yocto_dgram/yocto_dgram_gui.h>
 #include <yocto_dgram/yocto_dgram_shape.h>
 #include <yocto_dgram/yocto_dgram_text.h>
@@ -39,13 +41,129 @@
 
 using namespace yocto;
 
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <future>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 namespace fs = std::filesystem;
 
+// labels directory, defaulting to the one next to the scene
+string get_labels_dirname(const string& scene, const string& labels) {
+  if (!labels.empty()) return labels;
+  return (fs::u8path(scene).parent_path() / "labels").generic_u8string();
+}
+
+// png images are saved with the parallel encoder, other ones as by yocto
+bool is_png_filename(const string& filename) {
+  auto ext = fs::u8path(filename).extension().u8string();
+  for (auto& c : ext) c = (char)std::tolower((unsigned char)c);
+  return ext == ".png";
+}
+
+// cached labels that could not be loaded, and are skipped
+void print_label_warnings(const vector<string>& warnings) {
+  for (auto& warning : warnings) print_info("skip label: {}", warning);
+}
+
+// Rows of a sample being traced, taken in turn by its diagram and by the
+// batch jobs that help it
+struct batch_rows {
+  function<void(int)> trace   = {};
+  int                 count   = 0;
+  std::atomic<int>    next    = 0;
+  int                 helpers = 0;  // guarded by the pool mutex
+};
+
+// Jobs of a batch, shared by its diagrams. Once no diagram is left to
+// start, idle jobs help trace the samples of the ones still running, so the
+// last diagrams are not traced by a single job.
+struct batch_pool {
+  std::mutex              mutex   = {};
+  std::condition_variable ready   = {};
+  vector<batch_rows*>     rows    = {};
+  int                     running = 0;  // diagrams started and not done
+};
+
+// Traces rows until none is left
+void trace_rows(batch_rows& rows) {
+  for (auto j = rows.next++; j < rows.count; j = rows.next++) rows.trace(j);
+}
+
+// Helps trace the rows of the running diagrams, until all are done
+void help_batch(batch_pool& pool) {
+  auto lock = std::unique_lock{pool.mutex};
+  while (true) {
+    pool.ready.wait(
+        lock, [&pool]() { return !pool.rows.empty() || pool.running == 0; });
+    if (pool.rows.empty()) return;
+    auto rows = pool.rows.front();
+    if (rows->next >= rows->count) {
+      pool.rows.erase(pool.rows.begin());
+      continue;
+    }
+    rows->helpers++;
+    lock.unlock();
+    trace_rows(*rows);
+    lock.lock();
+    rows->helpers--;
+    pool.ready.notify_all();
+  }
+}
+
+// Renders a scene from its bundle as trace_scene, with the help of the idle
+// jobs of the batch. Each sample is split in rows, that are independent.
+dgram_trace_state trace_scene(const dgram_scene& scene,
+    const dgram_scene_bundle& bundle, const dgram_trace_params& params,
+    batch_pool& pool) {
+  auto state = make_state(params);
+  for (auto sample = 0; sample < params.samples; sample++) {
+    auto rows  = batch_rows{};
+    rows.count = state.height;
+    rows.trace = [&](int j) {
+      for (auto i = 0; i < state.width; i++)
+        trace_sample(state, scene, bundle.shapes, bundle.texts, bundle.bvh, i,
+            j, params);
+    };
+    {
+      auto lock = std::lock_guard{pool.mutex};
+      pool.rows.push_back(&rows);
+    }
+    pool.ready.notify_all();
+    trace_rows(rows);
+
+    // the rows are kept until the helpers that took them are done
+    auto lock = std::unique_lock{pool.mutex};
+    auto it   = std::find(pool.rows.begin(), pool.rows.end(), &rows);
+    if (it != pool.rows.end()) pool.rows.erase(it);
+    pool.ready.wait(lock, [&rows]() { return rows.helpers == 0; });
+    state.samples += 1;
+  }
+  return state;
+}
+
 // render params
 struct render_params {
   string             scene                  = "scene.json";
   string             output                 = "out.png";
+  string             labels                 = "";
+  string             bundle                 = "";
   int                resolution             = 0;
   bool               transparent_background = false;
   int                samples                = 9;
@@ -53,12 +171,16 @@ struct render_params {
   bool               noparallel             = false;
   dgram_sampler_type sampler                = dgram_sampler_type::color;
   antialiasing_type  antialiasing           = antialiasing_type::super_sampling;
+  int                pnglevel               = 6;
+  png_filter         pngfilter              = png_filter::adaptive;
 };
 
 // Cli
 void add_options(cli_command& cli, render_params& params) {
   add_option(cli, "scene", params.scene, "scene filename");
   add_option(cli, "output", params.output, "output filename");
+  add_option(cli, "labels", params.labels, "labels directory");
+  add_option(cli, "bundle", params.bundle, "precompiled scenes filename");
   add_option(cli, "resolution", params.resolution, "image resolution");
   add_option(cli, "transparent_background", params.transparent_background,
       "hide background");
@@ -69,11 +191,15 @@ void add_options(cli_command& cli, render_params& params) {
       antialiasing_labels);
   add_option(
       cli, "sampler", params.sampler, "sampler type", dgram_sampler_labels);
+  add_option(cli, "pnglevel", params.pnglevel, "png compression level");
+  add_option(
+      cli, "pngfilter", params.pngfilter, "png row filter", png_filter_labels);
 }
 
-// render diagram
-void run_render(const render_params& params_) {
-  print_info("rendering {}", params_.scene);
+// render diagram, logging its progress if verbose, in a batch if given
+void run_render(const render_params& params_, bool verbose = true,
+    batch_pool* pool = nullptr) {
+  if (verbose) print_info("rendering {}", params_.scene);
   auto timer = simple_timer{};
 
   // copy params
@@ -82,7 +208,8 @@ void run_render(const render_params& params_) {
   // scene loading
   timer      = simple_timer{};
   auto dgram = load_dgram(params.scene);
-  print_info("load diagram: {}", elapsed_formatted(timer));
+  dedup_scenes(dgram);
+  if (verbose) print_info("load diagram: {}", elapsed_formatted(timer));
 
   if (params.resolution == 0) params.resolution = 2 * (int)round(dgram.size.x);
 
@@ -90,61 +217,831 @@ void run_render(const render_params& params_) {
   auto width  = params.resolution;
   auto height = (int)round(params.resolution / aspect);
 
+  auto trace_params         = dgram_trace_params{};
+  trace_params.width        = width;
+  trace_params.height       = height;
+  trace_params.samples      = params.samples;
+  trace_params.noparallel   = params.noparallel;
+  trace_params.scale        = dgram.scale;
+  trace_params.size         = dgram.size;
+  trace_params.sampler      = params.sampler;
+  trace_params.antialiasing = params.antialiasing;
+
+  // precompiled scenes, reused only if built for the same render
+  auto labels_dirname = get_labels_dirname(params.scene, params.labels);
+  auto bundle         = dgram_bundle{};
+  auto bundled        = false;
+  if (!params.bundle.empty()) {
+    timer    = simple_timer{};
+    auto key = make_bundle_key(dgram, labels_dirname, trace_params.camera,
+        width, height, params.highqualitybvh);
+    auto error = string{"missing"};
+    if (fs::exists(fs::u8path(params.bundle)) &&
+        load_bundle(params.bundle, bundle, error)) {
+      bundled = bundle.key == key &&
+                bundle.scenes.size() == dgram.scenes.size();
+      if (!bundled) error = "outdated";
+    }
+    if (!bundled) bundle = {key, {}};
+    if (verbose)
+      print_info("load bundle: {}{}", elapsed_formatted(timer),
+          bundled ? "" : " (rebuilding, " + error + ")");
+  }
+  if (!bundled) bundle.scenes.resize(dgram.scenes.size());
+
+  // label loading
+  if (!bundled) {
+    timer         = simple_timer{};
+    auto warnings = load_texts(labels_dirname, dgram, params.noparallel);
+    if (verbose) print_info("load labels: {}", elapsed_formatted(timer));
+    if (verbose) print_label_warnings(warnings);
+  }
+
   auto image = make_image(width, height, false);
 
   if (!params.transparent_background)
     image.pixels = vector<vec4f>(width * height, vec4f{1, 1, 1, 1});
 
   for (auto idx = 0; idx < dgram.scenes.size(); idx++) {
-    auto& scene = dgram.scenes[idx];
-    timer       = simple_timer{};
-
-    auto params_         = dgram_trace_params{};
-    params_.width        = width;
-    params_.height       = height;
-    params_.samples      = params.samples;
-    params_.noparallel   = params.noparallel;
-    params_.scale        = dgram.scale;
-    params_.size         = dgram.size;
-    params_.sampler      = params.sampler;
-    params_.antialiasing = params.antialiasing;
-
-    // build bvh
-    auto shapes = make_shapes(
-        scene, params_.camera, params_.size, params_.scale, params_.noparallel);
-    auto bvh = make_bvh(shapes, params.highqualitybvh, params_.noparallel);
-
-    // make texts
-    auto texts = make_texts(scene, params_.camera, params_.size, params_.scale,
-        params_.width, params_.height, params_.noparallel);
-
-    // make state
-    auto state = make_state(params_);
+    auto& scene    = dgram.scenes[idx];
+    auto& compiled = bundle.scenes[idx];
+    timer          = simple_timer{};
 
-    // render
-    timer = simple_timer{};
-    for (auto sample = 0; sample < params.samples; sample++) {
-      auto sample_timer = simple_timer{};
-      trace_samples(state, scene, shapes, texts, bvh, params_);
-      print_info("render sample {}/{}: {}", sample + 1, params.samples,
-          elapsed_formatted(sample_timer));
+    // build shapes, bvh and texts
+    if (!bundled) {
+      compiled = make_scene_bundle(scene, trace_params, params.highqualitybvh);
+      if (verbose)
+        print_info("build scene: {}/{}: {}", idx + 1, dgram.scenes.size(),
+            elapsed_formatted(timer));
     }
-    print_info("render scene: {}/{}: {}", idx + 1, dgram.scenes.size(),
-        elapsed_formatted(timer));
 
-    image = composite_image(get_render(state), image);
+    // render
+    timer      = simple_timer{};
+    auto state = pool ? trace_scene(scene, compiled, trace_params, *pool)
+                      : trace_scene(scene, compiled, trace_params);
+    if (verbose)
+      print_info("render scene: {}/{}: {}", idx + 1, dgram.scenes.size(),
+          elapsed_formatted(timer));
+
+    composite_render(image, state, params.noparallel);
+
+    // scenes are kept only to be saved
+    if (params.bundle.empty()) compiled = {};
+  }
+
+  // save bundle
+  if (!params.bundle.empty() && !bundled) {
+    timer = simple_timer{};
+    save_bundle(params.bundle, bundle);
+    if (verbose) print_info("save bundle: {}", elapsed_formatted(timer));
   }
 
   // save image
   timer = simple_timer{};
-  if (is_hdr_filename(params.output)) convert_image(image, true);
-  save_image(params.output, image);
-  print_info("save image: {}", elapsed_formatted(timer));
+  if (is_png_filename(params.output)) {
+    save_image_png(params.output, image,
+        {params.pnglevel, params.pngfilter, params.noparallel});
+  } else {
+    save_image(params.output, image);
+  }
+  if (verbose) print_info("save image: {}", elapsed_formatted(timer));
+}
+
+// batch params
+struct batch_params {
+  vector<string>     scenes                 = {"scenes"};
+  string             output                 = "out";
+  int                jobs                   = 0;
+  int                resolution             = 0;
+  bool               transparent_background = false;
+  int                samples                = 9;
+  bool               highqualitybvh         = false;
+  bool               noparallel             = false;
+  dgram_sampler_type sampler                = dgram_sampler_type::color;
+  antialiasing_type  antialiasing           = antialiasing_type::super_sampling;
+  int                pnglevel               = 6;
+  png_filter         pngfilter              = png_filter::adaptive;
+};
+
+// Cli
+void add_options(cli_command& cli, batch_params& params) {
+  add_option(
+      cli, "scenes", params.scenes, "scene directories, globs or manifests");
+  add_option(cli, "output", params.output, "output directory");
+  add_option(
+      cli, "jobs", params.jobs, "diagrams rendered at once, 0 for all cores");
+  add_option(cli, "resolution", params.resolution, "image resolution");
+  add_option(cli, "transparent_background", params.transparent_background,
+      "hide background");
+  add_option(cli, "samples", params.samples, "number of samples");
+  add_option(cli, "highqualitybvh", params.highqualitybvh, "high quality bvh");
+  add_option(cli, "noparallel", params.noparallel, "disable threading");
+  add_option(cli, "antialiasing", params.antialiasing, "antialiasing type",
+      antialiasing_labels);
+  add_option(
+      cli, "sampler", params.sampler, "sampler type", dgram_sampler_labels);
+  add_option(cli, "pnglevel", params.pnglevel, "png compression level");
+  add_option(
+      cli, "pngfilter", params.pngfilter, "png row filter", png_filter_labels);
+}
+
+// match a path with a glob pattern, where `*` and `?` do not match
+// separators and `**/` matches any number of directories
+bool match_glob(std::string_view path, std::string_view pattern) {
+  if (pattern.empty()) return path.empty();
+  if (pattern.substr(0, 2) == "**") {
+    auto rest = pattern.substr(pattern.substr(0, 3) == "**/" ? 3 : 2);
+    if (rest.empty()) return true;
+    for (auto pos = (size_t)0; pos <= path.size(); pos++) {
+      if ((pos == 0 || path[pos - 1] == '/') &&
+          match_glob(path.substr(pos), rest))
+        return true;
+    }
+    return false;
+  }
+  if (pattern.front() == '*') {
+    for (auto pos = (size_t)0; pos <= path.size(); pos++) {
+      if (match_glob(path.substr(pos), pattern.substr(1))) return true;
+      if (pos < path.size() && path[pos] == '/') break;
+    }
+    return false;
+  }
+  if (path.empty()) return false;
+  if (pattern.front() == '?' ? path.front() == '/'
+                             : pattern.front() != path.front())
+    return false;
+  return match_glob(path.substr(1), pattern.substr(1));
+}
+
+// scenes of a batch, from directories, globs, manifests or scene files
+vector<string> find_batch_scenes(const vector<string>& inputs) {
+  auto scenes = vector<string>{};
+  auto found  = std::unordered_set<string>{};
+  auto add    = [&](const fs::path& path) {
+    auto ec  = std::error_code{};
+    auto key = fs::weakly_canonical(path, ec).generic_u8string();
+    if (ec) key = path.lexically_normal().generic_u8string();
+    if (found.insert(key).second)
+      scenes.push_back(path.lexically_normal().generic_u8string());
+  };
+  for (auto& input : inputs) {
+    auto path = fs::u8path(input);
+    if (fs::is_directory(path)) {
+      // all diagrams in the directory tree
+      auto paths = vector<fs::path>{};
+      for (auto& entry : fs::recursive_directory_iterator(path)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".json")
+          paths.push_back(entry.path());
+      }
+      std::sort(paths.begin(), paths.end());
+      for (auto& path : paths) add(path);
+    } else if (input.find_first_of("*?") != string::npos) {
+      // glob matched below its first directory without wildcards
+      auto wildcard = input.find_first_of("*?");
+      auto slash    = input.rfind('/', wildcard);
+      auto root     = fs::u8path(slash == string::npos
+                                     ? string{"."}
+                                     : input.substr(0, max(slash, (size_t)1)));
+      auto pattern  = slash == string::npos ? input : input.substr(slash + 1);
+      auto paths    = vector<fs::path>{};
+      if (fs::is_directory(root)) {
+        for (auto& entry : fs::recursive_directory_iterator(root)) {
+          auto relative = entry.path().lexically_relative(root);
+          if (entry.is_regular_file() &&
+              match_glob(relative.generic_u8string(), pattern))
+            paths.push_back(entry.path());
+        }
+      }
+      std::sort(paths.begin(), paths.end());
+      for (auto& path : paths) add(path);
+    } else if (path.extension() == ".json") {
+      add(path);
+    } else {
+      // manifest with one input per line, relative to the manifest
+      auto text   = load_text(input);
+      auto stream = std::istringstream{text};
+      auto line   = string{};
+      auto lines  = vector<string>{};
+      while (std::getline(stream, line)) {
+        auto start = line.find_first_not_of(" \t\r");
+        auto end   = line.find_last_not_of(" \t\r");
+        if (start == string::npos || line[start] == '#') continue;
+        auto entry = fs::u8path(line.substr(start, end - start + 1));
+        if (entry.is_relative()) entry = path.parent_path() / entry;
+        lines.push_back(entry.generic_u8string());
+      }
+      for (auto& scene : find_batch_scenes(lines)) add(fs::u8path(scene));
+    }
+  }
+  return scenes;
+}
+
+// output image named after the scene path, as in scripts/scenes.sh
+string get_batch_output(const string& scene, const string& output) {
+  auto path = fs::u8path(scene).parent_path();
+  if (path.filename() != fs::u8path(scene).stem())
+    path /= fs::u8path(scene).stem();
+  if (path.is_absolute()) path = path.lexically_proximate(fs::current_path());
+  auto name = string{};
+  for (auto c : path.lexically_normal().generic_u8string()) {
+    if (c == '/') {
+      name += "__";
+    } else {
+      name += c;
+    }
+  }
+  return (fs::u8path(output) / fs::u8path(name + ".png")).generic_u8string();
+}
+
+// render many diagrams, several at once, each with its own errors
+void run_batch(const batch_params& params_) {
+  auto timer = simple_timer{};
+
+  // scenes, with the largest files started first to shorten the tail
+  auto scenes = find_batch_scenes(params_.scenes);
+  if (scenes.empty()) throw io_error{"no scenes found"};
+  auto sizes = vector<uintmax_t>(scenes.size(), 0);
+  for (auto idx = (size_t)0; idx < scenes.size(); idx++) {
+    auto ec    = std::error_code{};
+    auto size  = fs::file_size(fs::u8path(scenes[idx]), ec);
+    sizes[idx] = ec ? 0 : size;
+  }
+  auto order = vector<size_t>(scenes.size());
+  for (auto idx = (size_t)0; idx < order.size(); idx++) order[idx] = idx;
+  std::stable_sort(order.begin(), order.end(),
+      [&sizes](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+  fs::create_directories(fs::u8path(params_.output));
+  print_info("rendering {} diagrams", scenes.size());
+
+  // render params shared by all diagrams
+  auto params                   = render_params{};
+  params.resolution             = params_.resolution;
+  params.transparent_background = params_.transparent_background;
+  params.samples                = params_.samples;
+  params.highqualitybvh         = params_.highqualitybvh;
+  params.noparallel             = params_.noparallel;
+  params.sampler                = params_.sampler;
+  params.antialiasing           = params_.antialiasing;
+  params.pnglevel               = params_.pnglevel;
+  params.pngfilter              = params_.pngfilter;
+
+  // diagrams are taken in turn by each job, so that loading and saving one
+  // overlaps with rendering the others. Jobs run single-threaded when many,
+  // since together they already take all the cores, and once no diagram is
+  // left they help trace the ones still running.
+  auto jobs = params_.jobs > 0
+                  ? params_.jobs
+                  : max((int)std::thread::hardware_concurrency(), 1);
+  if (params_.noparallel) jobs = 1;
+  jobs = min(jobs, (int)scenes.size());
+  if (jobs > 1) params.noparallel = true;
+  auto pool     = batch_pool{};
+  auto errors   = vector<string>(scenes.size());
+  auto next_idx = std::atomic<size_t>{0};
+  auto render   = [&]() {
+    while (true) {
+      auto idx = (size_t)0;
+      {
+        auto lock = std::lock_guard{pool.mutex};
+        idx       = next_idx.fetch_add(1);
+        if (idx < order.size()) pool.running++;
+      }
+      if (idx >= order.size()) break;
+      auto& scene = scenes[order[idx]];
+      auto  timer = simple_timer{};
+      try {
+        auto dparams   = params;
+        dparams.scene  = scene;
+        dparams.output = get_batch_output(scene, params_.output);
+        run_render(dparams, false, jobs > 1 ? &pool : nullptr);
+        print_info("render {}: {}", scene, elapsed_formatted(timer));
+      } catch (const std::exception& error) {
+        errors[order[idx]] = error.what();
+        print_error("{}: {}", scene, error.what());
+      }
+      {
+        auto lock = std::lock_guard{pool.mutex};
+        pool.running--;
+      }
+      pool.ready.notify_all();
+    }
+    help_batch(pool);
+  };
+  auto futures = vector<std::future<void>>{};
+  for (auto job = 0; job < jobs; job++) {
+    futures.emplace_back(std::async(std::launch::async, render));
+  }
+  for (auto& future : futures) future.get();
+
+  // report failures
+  auto failed = 0;
+  for (auto idx = (size_t)0; idx < scenes.size(); idx++) {
+    if (errors[idx].empty()) continue;
+    print_info("failed {}: {}", scenes[idx], errors[idx]);
+    failed++;
+  }
+  print_info("render batch: {}", elapsed_formatted(timer));
+  if (failed != 0)
+    throw io_error{std::to_string(failed) + " of " +
+                   std::to_string(scenes.size()) + " diagrams failed"};
+}
+
+// serve params
+struct serve_params {
+  int  jobs       = 4;
+  int  scenes     = 64;
+  int  bundles    = 16;
+  int  images     = 256;
+  bool noparallel = false;
+};
+
+// Cli
+void add_options(cli_command& cli, serve_params& params) {
+  add_option(cli, "jobs", params.jobs, "requests rendered at once");
+  add_option(cli, "scenes", params.scenes, "cached diagrams");
+  add_option(cli, "bundles", params.bundles, "cached prepared diagrams");
+  add_option(cli, "images", params.images, "cached images");
+  add_option(cli, "noparallel", params.noparallel, "disable threading");
+}
+
+// Thread-safe cache that keeps the most recently used values. Values
+// requested concurrently are built once, while failed builds are dropped.
+template <typename T>
+struct lru_cache {
+  struct entry {
+    string                                       key   = "";
+    size_t                                       id    = 0;
+    std::shared_future<std::shared_ptr<const T>> value = {};
+  };
+  size_t           capacity = 0;
+  size_t           next_id  = 0;
+  std::mutex       mutex    = {};
+  std::list<entry> entries  = {};
+
+  std::unordered_map<string, typename std::list<entry>::iterator> lookup = {};
+};
+
+// Gets a value from the cache, building it with `make` if missing
+template <typename T, typename Func>
+std::shared_ptr<const T> get_cached(
+    lru_cache<T>& cache, const string& key, Func&& make, bool& hit) {
+  auto promise = std::promise<std::shared_ptr<const T>>{};
+  auto value   = std::shared_future<std::shared_ptr<const T>>{};
+  auto id      = (size_t)0;
+  {
+    auto lock = std::lock_guard{cache.mutex};
+    auto it   = cache.lookup.find(key);
+    hit       = it != cache.lookup.end();
+    if (hit) {
+      cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+      value = it->second->value;
+    } else {
+      id    = cache.next_id++;
+      value = promise.get_future().share();
+      cache.entries.push_front({key, id, value});
+      cache.lookup[key] = cache.entries.begin();
+      while (cache.entries.size() > cache.capacity) {
+        cache.lookup.erase(cache.entries.back().key);
+        cache.entries.pop_back();
+      }
+    }
+  }
+  if (hit) return value.get();
+
+  try {
+    auto result = std::make_shared<const T>(make());
+    promise.set_value(result);
+    return result;
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+    auto lock = std::lock_guard{cache.mutex};
+    auto it   = cache.lookup.find(key);
+    if (it != cache.lookup.end() && it->second->id == id) {
+      cache.entries.erase(it->second);
+      cache.lookup.erase(it);
+    }
+    throw;
+  }
+}
+
+// Prepared diagram kept by the server, that keeps alive the diagram its
+// shapes borrow from
+struct serve_bundle {
+  std::shared_ptr<const dgram_scenes> dgram  = nullptr;
+  dgram_bundle                        bundle = {};
+};
+
+// Encoded image kept by the server
+struct serve_image {
+  int          width  = 0;
+  int          height = 0;
+  vector<byte> png    = {};
+};
+
+// Caches of the server, from parsed diagrams, and diagrams with their
+// labels, to encoded images
+struct serve_caches {
+  lru_cache<dgram_scenes> scenes  = {};
+  lru_cache<dgram_scenes> labeled = {};
+  lru_cache<serve_bundle> bundles = {};
+  lru_cache<serve_image>  images  = {};
+};
+
+// Request fields, that keep their default if missing
+template <typename T>
+void get_field(const nlohmann::json& request, const string& key, T& value) {
+  if (request.contains(key)) value = request.at(key).get<T>();
+}
+template <typename T>
+void get_field(const nlohmann::json& request, const string& key, T& value,
+    const vector<pair<T, string>>& labels) {
+  if (!request.contains(key)) return;
+  auto label = request.at(key).get<string>();
+  for (auto& [item, name] : labels) {
+    if (name != label) continue;
+    value = item;
+    return;
+  }
+  throw io_error{"unknown " + key + " " + label};
+}
+
+// Renders a request, reusing what the caches already have. Returns the
+// response header and the encoded image.
+pair<nlohmann::json, std::shared_ptr<const serve_image>> serve_request(
+    const nlohmann::json& request, serve_caches& caches, bool noparallel) {
+  // diagram, from a file or from the request itself
+  auto source = string{}, dirname = string{}, text = string{};
+  if (request.contains("scene")) {
+    source    = request.at("scene").get<string>();
+    auto path = fs::u8path(source);
+    dirname   = path.parent_path().generic_u8string();
+    auto ec   = std::error_code{};
+    auto time = fs::last_write_time(path, ec).time_since_epoch().count();
+    auto size = fs::file_size(path, ec);
+    if (ec) throw io_error{"cannot open " + source};
+    source    = "file:" +
+             fs::absolute(path).lexically_normal().generic_u8string() + ":" +
+             std::to_string(time) + ":" + std::to_string(size);
+  } else if (request.contains("dgram")) {
+    auto& dgram = request.at("dgram");
+    text        = dgram.is_string() ? dgram.get<string>() : dgram.dump();
+    get_field(request, "dirname", dirname);
+    source = "text:" + dirname + ":" + std::to_string(text.size()) + ":" +
+             std::to_string(std::hash<string>{}(text));
+  } else {
+    throw io_error{"missing scene"};
+  }
+  auto labels = (fs::u8path(dirname) / "labels").generic_u8string();
+  get_field(request, "labels", labels);
+
+  auto scene_hit = false;
+  auto dgram     = get_cached(
+      caches.scenes, source,
+      [&]() {
+        auto dgram = request.contains("scene")
+                         ? load_dgram(request.at("scene").get<string>())
+                         : parse_dgram(text, dirname);
+        dedup_scenes(dgram);
+        return dgram;
+      },
+      scene_hit);
+
+  // render params
+  auto params                 = dgram_trace_params{};
+  auto resolution             = 0;
+  auto highqualitybvh         = false;
+  auto transparent_background = false;
+  auto pngparams              = png_params{};
+  get_field(request, "camera", params.camera);
+  get_field(request, "resolution", resolution);
+  get_field(request, "samples", params.samples);
+  get_field(request, "sampler", params.sampler, dgram_sampler_labels);
+  get_field(
+      request, "antialiasing", params.antialiasing, antialiasing_labels);
+  get_field(request, "highqualitybvh", highqualitybvh);
+  get_field(request, "transparent_background", transparent_background);
+  get_field(request, "pnglevel", pngparams.level);
+  get_field(request, "pngfilter", pngparams.filter, png_filter_labels);
+  if (resolution == 0) resolution = 2 * (int)round(dgram->size.x);
+  auto aspect          = dgram->size.x / dgram->size.y;
+  params.width         = resolution;
+  params.height        = (int)round(resolution / aspect);
+  params.scale         = dgram->scale;
+  params.size          = dgram->size;
+  params.noparallel    = noparallel;
+  pngparams.noparallel = noparallel;
+
+  // images are keyed by the bundle, that covers the diagram and its labels
+  auto labeled_key = source + ":" + make_labels_key(*dgram, labels);
+  auto bundle_key  = labeled_key + ":" + std::to_string(params.camera) + ":" +
+                    std::to_string(params.width) + ":" +
+                    std::to_string(params.height) + ":" +
+                    std::to_string(highqualitybvh);
+  auto image_key  = bundle_key + ":" + std::to_string(params.samples) + ":" +
+                   std::to_string((int)params.sampler) + ":" +
+                   std::to_string((int)params.antialiasing) + ":" +
+                   std::to_string(transparent_background) + ":" +
+                   std::to_string(pngparams.level) + ":" +
+                   std::to_string((int)pngparams.filter);
+
+  auto bundle_hit = false, image_hit = false;
+  auto image      = get_cached(
+      caches.images, image_key,
+      [&]() {
+        auto bundle = get_cached(
+            caches.bundles, bundle_key,
+            [&]() {
+              // labels are loaded once for each state of the label cache,
+              // in a copy of the diagram shared by its bundles
+              auto labeled_hit = false;
+              auto labeled     = get_cached(
+                  caches.labeled, labeled_key,
+                  [&]() {
+                    auto labeled = *dgram;
+                    load_texts(labels, labeled, noparallel);
+                    return labeled;
+                  },
+                  labeled_hit);
+              auto bundle = serve_bundle{labeled, {bundle_key, {}}};
+              for (auto& scene : bundle.dgram->scenes)
+                bundle.bundle.scenes.push_back(
+                    make_scene_bundle(scene, params, highqualitybvh));
+              return bundle;
+            },
+            bundle_hit);
+
+        auto render = make_image(params.width, params.height, false);
+        if (!transparent_background)
+          render.pixels = vector<vec4f>(
+              params.width * params.height, vec4f{1, 1, 1, 1});
+        auto& scenes = bundle->dgram->scenes;
+        for (auto idx = (size_t)0; idx < scenes.size(); idx++)
+          composite_render(render,
+              trace_scene(scenes[idx], bundle->bundle.scenes[idx], params),
+              noparallel);
+        return serve_image{
+            params.width, params.height, make_image_png(render, pngparams)};
+      },
+      image_hit);
+
+  // the image is saved if requested, and sent otherwise
+  auto output = string{};
+  get_field(request, "output", output);
+  if (!output.empty()) save_binary(output, image->png);
+
+  auto header      = nlohmann::json::object();
+  header["ok"]     = true;
+  header["width"]  = image->width;
+  header["height"] = image->height;
+  header["size"]   = output.empty() ? image->png.size() : 0;
+  header["cached"] = image_hit    ? "image"
+                     : bundle_hit ? "bundle"
+                     : scene_hit  ? "scene"
+                                  : "none";
+  if (!output.empty()) header["output"] = output;
+  return {header, output.empty() ? image : nullptr};
+}
+
+// Serves render requests read from stdin, one json object per line. Each
+// response is a json line, followed by as many png bytes as its size.
+// Responses may come out of order, and carry the id of their request.
+void run_serve(const serve_params& params_) {
+#ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+  auto caches             = serve_caches{};
+  caches.scenes.capacity  = max(params_.scenes, 0);
+  caches.bundles.capacity = max(params_.bundles, 0);
+  caches.labeled.capacity = max(params_.bundles, 0);
+  caches.images.capacity  = max(params_.images, 0);
+
+  // responses are written whole
+  auto output_mutex = std::mutex{};
+  auto respond      = [&](const nlohmann::json& header,
+                         const std::shared_ptr<const serve_image>& image) {
+    auto line = header.dump() + "\n";
+    auto lock = std::lock_guard{output_mutex};
+    fwrite(line.data(), 1, line.size(), stdout);
+    if (image) fwrite(image->png.data(), 1, image->png.size(), stdout);
+    fflush(stdout);
+  };
+
+  // requests are queued for the workers, that live as long as the server
+  auto queue_mutex     = std::mutex{};
+  auto queue_condition = std::condition_variable{};
+  auto queue           = std::deque<string>{};
+  auto done            = false;
+  auto work            = [&]() {
+    while (true) {
+      auto line = string{};
+      {
+        auto lock = std::unique_lock{queue_mutex};
+        queue_condition.wait(lock, [&]() { return done || !queue.empty(); });
+        if (queue.empty()) break;
+        line = std::move(queue.front());
+        queue.pop_front();
+      }
+      auto id = nlohmann::json{};
+      try {
+        auto request = nlohmann::json::parse(line);
+        if (request.contains("id")) id = request.at("id");
+        auto [header, image] = serve_request(
+            request, caches, params_.noparallel);
+        header["id"] = id;
+        respond(header, image);
+      } catch (const std::exception& error) {
+        auto header     = nlohmann::json::object();
+        header["id"]    = id;
+        header["ok"]    = false;
+        header["error"] = error.what();
+        respond(header, nullptr);
+      }
+    }
+  };
+  auto jobs    = params_.noparallel ? 1 : max(params_.jobs, 1);
+  auto workers = vector<std::future<void>>{};
+  for (auto job = 0; job < jobs; job++) {
+    workers.emplace_back(std::async(std::launch::async, work));
+  }
+
+  // read requests until the input is closed
+  auto line = string{};
+  while (std::getline(std::cin, line)) {
+    if (line.find_first_not_of(" \t\r") == string::npos) continue;
+    {
+      auto lock = std::lock_guard{queue_mutex};
+      queue.push_back(std::move(line));
+    }
+    queue_condition.notify_one();
+  }
+  {
+    auto lock = std::lock_guard{queue_mutex};
+    done      = true;
+  }
+  queue_condition.notify_all();
+  for (auto& worker : workers) worker.get();
+}
+
+// watch params
+struct watch_params {
+  string             scene                  = "scene.json";
+  string             output                 = "out.png";
+  string             labels                 = "";
+  int                resolution             = 0;
+  bool               transparent_background = false;
+  int                samples                = 9;
+  bool               highqualitybvh         = false;
+  bool               noparallel             = false;
+  dgram_sampler_type sampler                = dgram_sampler_type::color;
+  antialiasing_type  antialiasing           = antialiasing_type::super_sampling;
+  int                pnglevel               = 6;
+  png_filter         pngfilter              = png_filter::adaptive;
+  int                interval               = 250;
+};
+
+// Cli
+void add_options(cli_command& cli, watch_params& params) {
+  add_option(cli, "scene", params.scene, "scene filename");
+  add_option(cli, "output", params.output, "output filename");
+  add_option(cli, "labels", params.labels, "labels directory");
+  add_option(cli, "resolution", params.resolution, "image resolution");
+  add_option(cli, "transparent_background", params.transparent_background,
+      "hide background");
+  add_option(cli, "samples", params.samples, "number of samples");
+  add_option(cli, "highqualitybvh", params.highqualitybvh, "high quality bvh");
+  add_option(cli, "noparallel", params.noparallel, "disable threading");
+  add_option(cli, "antialiasing", params.antialiasing, "antialiasing type",
+      antialiasing_labels);
+  add_option(
+      cli, "sampler", params.sampler, "sampler type", dgram_sampler_labels);
+  add_option(cli, "pnglevel", params.pnglevel, "png compression level");
+  add_option(
+      cli, "pngfilter", params.pngfilter, "png row filter", png_filter_labels);
+  add_option(cli, "interval", params.interval, "polling interval in ms");
+}
+
+// Scene of a watched diagram, kept with its render until it changes. Moving
+// a layer keeps the arrays its shapes borrow in place.
+struct watch_layer {
+  string             key      = "";
+  dgram_scene        scene    = {};
+  dgram_scene_bundle compiled = {};
+  image_data         render   = {};
+};
+
+// Modification times of the diagram and of the labels directory, that
+// changes when label images are added
+string get_watch_stamp(const string& scene, const string& labels) {
+  auto stamp = string{};
+  for (auto& filename : {scene, labels}) {
+    auto ec   = std::error_code{};
+    auto time = fs::last_write_time(fs::u8path(filename), ec);
+    stamp += ec ? string{"-"} : std::to_string(time.time_since_epoch().count());
+    stamp += ":";
+  }
+  return stamp;
+}
+
+// Renders the changed scenes of a diagram, reusing the layers of the others
+void update_watch(const watch_params& params, const string& labels,
+    vector<watch_layer>& layers) {
+  auto timer = simple_timer{};
+  auto dgram = load_dgram(params.scene);
+  dedup_scenes(dgram);
+
+  auto resolution = params.resolution;
+  if (resolution == 0) resolution = 2 * (int)round(dgram.size.x);
+  auto aspect = dgram.size.x / dgram.size.y;
+
+  auto trace_params         = dgram_trace_params{};
+  trace_params.width        = resolution;
+  trace_params.height       = (int)round(resolution / aspect);
+  trace_params.samples      = params.samples;
+  trace_params.noparallel   = params.noparallel;
+  trace_params.scale        = dgram.scale;
+  trace_params.size         = dgram.size;
+  trace_params.sampler      = params.sampler;
+  trace_params.antialiasing = params.antialiasing;
+
+  // unchanged scenes take their previous layer, at most once
+  auto lookup = std::unordered_map<string, size_t>{};
+  for (auto idx = (size_t)0; idx < layers.size(); idx++)
+    lookup.insert({layers[idx].key, idx});
+  auto next    = vector<watch_layer>(dgram.scenes.size());
+  auto changed = vector<size_t>{};
+  for (auto idx = (size_t)0; idx < dgram.scenes.size(); idx++) {
+    auto key = make_scene_key(dgram, (int)idx, labels, trace_params.camera,
+        trace_params.width, trace_params.height, params.highqualitybvh);
+    auto it  = lookup.find(key);
+    if (it != lookup.end()) {
+      next[idx] = std::move(layers[it->second]);
+      lookup.erase(it);
+    } else {
+      next[idx].key = key;
+      changed.push_back(idx);
+    }
+  }
+
+  // labels are loaded only for the changed scenes
+  auto partial = dgram_scenes{dgram.size, dgram.scale, {}};
+  for (auto idx : changed)
+    partial.scenes.push_back(std::move(dgram.scenes[idx]));
+  print_label_warnings(load_texts(labels, partial, params.noparallel));
+  for (auto pos = (size_t)0; pos < changed.size(); pos++)
+    next[changed[pos]].scene = std::move(partial.scenes[pos]);
+
+  for (auto idx : changed) {
+    auto& layer    = next[idx];
+    layer.compiled = make_scene_bundle(
+        layer.scene, trace_params, params.highqualitybvh);
+    layer.render   = get_render(
+        trace_scene(layer.scene, layer.compiled, trace_params));
+  }
+  layers = std::move(next);
+
+  // composite the layers in order
+  auto image = make_image(trace_params.width, trace_params.height, false);
+  if (!params.transparent_background)
+    image.pixels = vector<vec4f>(
+        trace_params.width * trace_params.height, vec4f{1, 1, 1, 1});
+  for (auto& layer : layers) composite_image_mt(image, layer.render, image);
+
+  if (is_png_filename(params.output)) {
+    save_image_png(params.output, image,
+        {params.pnglevel, params.pngfilter, params.noparallel});
+  } else {
+    save_image(params.output, image);
+  }
+  print_info("render {}/{} scenes: {}", changed.size(), layers.size(),
+      elapsed_formatted(timer));
+}
+
+// render a diagram again whenever it or its labels change
+void run_watch(const watch_params& params) {
+  print_info("watching {}", params.scene);
+  auto labels = get_labels_dirname(params.scene, params.labels);
+  auto layers = vector<watch_layer>{};
+  auto stamp  = string{};
+  while (true) {
+    auto current = get_watch_stamp(params.scene, labels);
+    if (current != stamp) {
+      stamp = current;
+      try {
+        update_watch(params, labels, layers);
+      } catch (const std::exception& error) {
+        print_error(error.what());
+      }
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(max(params.interval, 1)));
+  }
 }
 
 // view params
 struct view_params {
   string             scene                  = "scene.json";
+  string             labels                 = "";
   int                resolution             = 0;
   bool               transparent_background = false;
   int                samples                = 9;
@@ -157,6 +1054,7 @@ struct view_params {
 // Cli
 void add_options(cli_command& cli, view_params& params) {
   add_option(cli, "scene", params.scene, "scene filename");
+  add_option(cli, "labels", params.labels, "labels directory");
   add_option(cli, "resolution", params.resolution, "image resolution");
   add_option(cli, "transparent_background", params.transparent_background,
       "hide background");
@@ -176,6 +1074,9 @@ void run_view(const view_params& params_) {
   // scene loading
   timer      = simple_timer{};
   auto dgram = load_dgram(params_.scene);
+  print_label_warnings(load_texts(
+      get_labels_dirname(params_.scene, params_.labels), dgram,
+      params_.noparallel));
   print_info("load diagram: {}", elapsed_formatted(timer));
 
   auto params         = dgram_trace_params{};
@@ -199,33 +1100,105 @@ void run_view(const view_params& params_) {
   show_dgram_gui(dgram, params, params_.transparent_background);
 }
 
+// export params
+struct export_params {
+  string scene                  = "scene.json";
+  string output                 = "out.svg";
+  string labels                 = "";
+  int    resolution             = 0;
+  bool   transparent_background = false;
+  bool   noparallel             = false;
+};
+
+// Cli
+void add_options(cli_command& cli, export_params& params) {
+  add_option(cli, "scene", params.scene, "scene filename");
+  add_option(cli, "output", params.output, "output filename (svg or pdf)");
+  add_option(cli, "labels", params.labels, "labels directory");
+  add_option(cli, "resolution", params.resolution, "labels resolution");
+  add_option(cli, "transparent_background", params.transparent_background,
+      "hide background");
+  add_option(cli, "noparallel", params.noparallel, "disable threading");
+}
+
+// export diagram as vector graphics
+void run_export(const export_params& params_) {
+  print_info("exporting {}", params_.scene);
+  auto timer = simple_timer{};
+
+  // scene loading
+  timer      = simple_timer{};
+  auto dgram = load_dgram(params_.scene);
+  print_label_warnings(load_texts(
+      get_labels_dirname(params_.scene, params_.labels), dgram,
+      params_.noparallel));
+  print_info("load diagram: {}", elapsed_formatted(timer));
+
+  auto params                   = dgram_export_params{};
+  params.width                  = params_.resolution;
+  params.transparent_background = params_.transparent_background;
+  params.noparallel             = params_.noparallel;
+
+  // export
+  timer    = simple_timer{};
+  auto ext = fs::u8path(params_.output).extension().u8string();
+  if (ext == ".svg") {
+    save_text(params_.output, make_dgram_svg(dgram, params));
+  } else if (ext == ".pdf") {
+    save_binary(params_.output, make_dgram_pdf(dgram, params));
+  } else {
+    throw io_error{"unsupported format " + ext};
+  }
+  print_info("export diagram: {}", elapsed_formatted(timer));
+}
+
 // text params
 struct text_params {
-  string scene      = "scene.json";
-  int    resolution = 0;
-  bool   noparallel = false;
+  vector<string> scenes      = {"scene.json"};
+  string         labels      = "";
+  int            resolution  = 0;
+  int            concurrency = 8;
+  int            timeout     = 30000;
+  int            retries     = 2;
+  bool           noparallel  = false;
 };
 
 // Cli
 void add_options(cli_command& cli, text_params& params) {
-  add_option(cli, "scene", params.scene, "scene filename");
+  add_option(cli, "scene", params.scenes, "scene filenames");
+  add_option(cli, "labels", params.labels, "labels directory");
   add_option(cli, "resolution", params.resolution, "image resolution");
+  add_option(cli, "concurrency", params.concurrency, "concurrent requests");
+  add_option(cli, "timeout", params.timeout, "request timeout in ms");
+  add_option(cli, "retries", params.retries, "retries of failed requests");
   add_option(cli, "noparallel", params.noparallel, "disable threading");
 }
 
 void run_text(const text_params& params_) {
-  print_info("rendering {}", params_.scene);
   auto timer = simple_timer{};
 
   // scene loading
-  timer      = simple_timer{};
-  auto dgram = load_dgram(params_.scene);
-  print_info("load diagram: {}", elapsed_formatted(timer));
+  auto dgrams      = vector<dgram_scenes>{};
+  auto dirnames    = vector<string>{};
+  auto resolutions = vector<int>{};
+  for (auto& scene : params_.scenes) {
+    print_info("rendering {}", scene);
+    timer = simple_timer{};
+    dgrams.push_back(load_dgram(scene));
+    dirnames.push_back(get_labels_dirname(scene, params_.labels));
+    resolutions.push_back(params_.resolution);
+    print_info("load diagram: {}", elapsed_formatted(timer));
+  }
 
-  auto resolution = params_.resolution;
-  if (resolution == 0) resolution = 2 * (int)round(dgram.size.x);
+  // requests for all diagrams share the connections
+  auto params        = text_client_params{};
+  params.concurrency = params_.noparallel ? 1 : params_.concurrency;
+  params.timeout     = params_.timeout;
+  params.retries     = params_.retries;
 
-  save_texts(params_.scene, dgram, resolution);
+  timer = simple_timer{};
+  save_texts(dirnames, dgrams, resolutions, params);
+  print_info("render labels: {}", elapsed_formatted(timer));
 }
 
 struct app_params {
@@ -233,6 +1206,10 @@ struct app_params {
   render_params render  = {};
   view_params   view    = {};
   text_params   text    = {};
+  export_params export_ = {};
+  batch_params  batch   = {};
+  serve_params  serve   = {};
+  watch_params  watch   = {};
 };
 
 // Run
@@ -245,6 +1222,10 @@ int main(int argc, const char* argv[]) {
     add_command(cli, "render", params.render, "render diagrams");
     add_command(cli, "view", params.view, "view diagrams");
     add_command(cli, "render_text", params.text, "render text for diagrams");
+    add_command(cli, "export", params.export_, "export diagrams as svg or pdf");
+    add_command(cli, "batch", params.batch, "render many diagrams");
+    add_command(cli, "serve", params.serve, "serve render requests");
+    add_command(cli, "watch", params.watch, "render diagrams when they change");
     parse_cli(cli, argc, argv);
 
     // dispatch commands
@@ -254,6 +1235,14 @@ int main(int argc, const char* argv[]) {
       run_view(params.view);
     } else if (params.command == "render_text") {
       run_text(params.text);
+    } else if (params.command == "export") {
+      run_export(params.export_);
+    } else if (params.command == "batch") {
+      run_batch(params.batch);
+    } else if (params.command == "serve") {
+      run_serve(params.serve);
+    } else if (params.command == "watch") {
+      run_watch(params.watch);
     } else {
       throw io_error{"unknown command"};
     }
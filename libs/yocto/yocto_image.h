@@ -94,6 +94,8 @@ inline void  set_pixel(image_data& image, int i, int j, const vec4f& pixel);
 // conversions
 image_data convert_image(const image_data& image, bool linear);
 void       convert_image(image_data& result, const image_data& image);
+// conversions using multithreading for speed
+void convert_image_mt(image_data& result, const image_data& image);
 
 // Evaluates an image at a point `uv`.
 vec4f eval_image(const image_data& image, const vec2f& uv,
@@ -130,6 +132,9 @@ image_data composite_image(
 // Composite two images together.
 void composite_image(
     image_data& result, const image_data& image_a, const image_data& image_b);
+// Composite two images together using multithreading for speed.
+void composite_image_mt(
+    image_data& result, const image_data& image_a, const image_data& image_b);
 
 // Composite two images together.
 void composite_image(image_data& result, const vector<image_data>& images);
@@ -231,6 +236,9 @@ namespace yocto {
 // Conversion from/to floats.
 void byte_to_float(vector<vec4f>& fl, const vector<vec4b>& bt);
 void float_to_byte(vector<vec4b>& bt, const vector<vec4f>& fl);
+void float_to_byte(vec4b* bt, const vec4f* fl, size_t count);
+// Conversion to bytes using multithreading for speed.
+void float_to_byte_mt(vector<vec4b>& bt, const vector<vec4f>& fl);
 
 // Conversion between linear and gamma-encoded images.
 void srgb_to_rgb(vector<vec4f>& rgb, const vector<vec4f>& srgb);
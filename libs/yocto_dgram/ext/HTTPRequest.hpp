@@ -493,11 +493,46 @@ namespace http {
           headers, timeout);
     }
 
+    // The connection is kept alive between requests sent by the same object,
+    // unless the server closes it. Since the server may drop an idle
+    // connection at any time, a request that fails on a reused connection is
+    // sent again once on a fresh one.
     Response send(const std::string& method, const std::vector<uint8_t>& body,
         const std::vector<std::string>& headers,
         const std::chrono::milliseconds timeout = std::chrono::milliseconds{
             -1}) {
+      if (connection) {
+        try {
+          auto response = sendRequest(method, body, headers, timeout);
+          if (response.status != 0) return response;
+        } catch (const std::system_error&) {
+        }
+        connection.reset();
+      }
+      return sendRequest(method, body, headers, timeout);
+    }
+
+   private:
+    Response sendRequest(const std::string& method,
+        const std::vector<uint8_t>&         body,
+        const std::vector<std::string>&     headers,
+        const std::chrono::milliseconds     timeout) {
+      try {
+        auto response = sendRequestOnce(method, body, headers, timeout);
+        if (!keepAlive) connection.reset();
+        return response;
+      } catch (...) {
+        connection.reset();
+        throw;
+      }
+    }
+
+    Response sendRequestOnce(const std::string& method,
+        const std::vector<uint8_t>&             body,
+        const std::vector<std::string>&         headers,
+        const std::chrono::milliseconds         timeout) {
       const auto stopTime = std::chrono::steady_clock::now() + timeout;
+      keepAlive           = false;
 
       if (scheme != "http") throw RequestError("Only HTTP scheme is supported");
 
@@ -529,12 +564,15 @@ namespace http {
       std::vector<uint8_t> requestData(headerData.begin(), headerData.end());
       requestData.insert(requestData.end(), body.begin(), body.end());
 
-      Socket socket{internetProtocol};
+      if (!connection) {
+        connection.reset(new Socket{internetProtocol});
 
-      // take the first address from the list
-      socket.connect(addressInfo->ai_addr,
-          static_cast<socklen_t>(addressInfo->ai_addrlen),
-          (timeout.count() >= 0) ? getRemainingMilliseconds(stopTime) : -1);
+        // take the first address from the list
+        connection->connect(addressInfo->ai_addr,
+            static_cast<socklen_t>(addressInfo->ai_addrlen),
+            (timeout.count() >= 0) ? getRemainingMilliseconds(stopTime) : -1);
+      }
+      auto& socket = *connection;
 
       auto remaining = requestData.size();
       auto sendData  = requestData.data();
@@ -561,6 +599,7 @@ namespace http {
       bool        chunkedResponse       = false;
       std::size_t expectedChunkSize     = 0;
       bool        removeCrlfAfterChunk  = false;
+      bool        closeReceived         = false;
 
       // read the response
       for (;;) {
@@ -648,6 +687,12 @@ namespace http {
                                     .base(),
                   headerValue.end());
 
+              if (headerName == "connection") {
+                std::transform(headerValue.begin(), headerValue.end(),
+                    headerValue.begin(), toLower);
+                closeReceived = headerValue == "close";
+              }
+
               if (headerName == "content-length") {
                 contentLength         = std::stoul(headerValue);
                 contentLengthReceived = true;
@@ -702,7 +747,10 @@ namespace http {
                 responseData.erase(responseData.begin(), i + 2);
 
                 expectedChunkSize = std::stoul(line, nullptr, 16);
-                if (expectedChunkSize == 0) return response;
+                if (expectedChunkSize == 0) {
+                  keepAlive = !closeReceived;
+                  return response;
+                }
               }
             }
           } else {
@@ -711,8 +759,12 @@ namespace http {
             responseData.clear();
 
             // got the whole content
-            if (contentLengthReceived && response.body.size() >= contentLength)
+            if (contentLengthReceived &&
+                response.body.size() >= contentLength) {
+              keepAlive = !closeReceived &&
+                          response.body.size() == contentLength;
               return response;
+            }
           }
         }
       }
@@ -732,12 +784,14 @@ namespace http {
 #if defined(_WIN32) || defined(__CYGWIN__)
     WinSock winSock;
 #endif  // defined(_WIN32) || defined(__CYGWIN__)
-    InternetProtocol internetProtocol;
-    std::string      scheme;
-    std::string      host;
-    std::string      domain;
-    std::string      port;
-    std::string      path;
+    InternetProtocol        internetProtocol;
+    std::unique_ptr<Socket> connection;
+    bool                    keepAlive = false;
+    std::string             scheme;
+    std::string             host;
+    std::string             domain;
+    std::string             port;
+    std::string             path;
   };
 }  // namespace http
 
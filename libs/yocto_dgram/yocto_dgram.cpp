@@ -32,6 +32,9 @@
 
 #include "yocto_dgram.h"
 
+#include <cstring>
+#include <unordered_map>
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
@@ -74,3 +77,196 @@ namespace yocto {
   }
 
 }  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// DGRAM DEDUPLICATION
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Hashes values with 64-bit FNV-1a over their bytes
+  template <typename T>
+  static void hash_values(size_t& hash, const T* values, size_t count) {
+    auto bytes = (const uint8_t*)values;
+    for (auto idx = (size_t)0; idx < count * sizeof(T); idx++) {
+      hash ^= (size_t)bytes[idx];
+      hash *= (size_t)1099511628211ull;
+    }
+  }
+  template <typename T>
+  static void hash_values(size_t& hash, const vector<T>& values) {
+    auto size = values.size();
+    hash_values(hash, &size, 1);
+    hash_values(hash, values.data(), values.size());
+  }
+  template <typename T>
+  static bool equal_values(const vector<T>& a, const vector<T>& b) {
+    return a.size() == b.size() &&
+           (a.empty() ||
+               memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+  }
+
+  static size_t hash_shape(const dgram_shape& shape) {
+    auto hash = (size_t)14695981039346656037ull;
+    hash_values(hash, shape.positions);
+    hash_values(hash, shape.points);
+    hash_values(hash, shape.lines);
+    hash_values(hash, shape.triangles);
+    hash_values(hash, shape.quads);
+    hash_values(hash, shape.fills);
+    hash_values(hash, shape.ends);
+    hash_values(hash, &shape.cull, 1);
+    hash_values(hash, &shape.boundary, 1);
+    return hash;
+  }
+  static bool equal_shapes(const dgram_shape& a, const dgram_shape& b) {
+    return equal_values(a.positions, b.positions) &&
+           equal_values(a.points, b.points) && equal_values(a.lines, b.lines) &&
+           equal_values(a.triangles, b.triangles) &&
+           equal_values(a.quads, b.quads) && equal_values(a.fills, b.fills) &&
+           equal_values(a.ends, b.ends) && a.cull == b.cull &&
+           a.boundary == b.boundary;
+  }
+
+  static size_t hash_material(const dgram_material& material) {
+    auto hash = (size_t)14695981039346656037ull;
+    hash_values(hash, &material.fill, 1);
+    hash_values(hash, &material.stroke, 1);
+    hash_values(hash, &material.thickness, 1);
+    hash_values(hash, &material.dash_period, 1);
+    hash_values(hash, &material.dash_phase, 1);
+    hash_values(hash, &material.dash_on, 1);
+    hash_values(hash, &material.dash_cap, 1);
+    hash_values(hash, &material.dashed, 1);
+    return hash;
+  }
+  static bool equal_materials(
+      const dgram_material& a, const dgram_material& b) {
+    return a.fill == b.fill && a.stroke == b.stroke &&
+           a.thickness == b.thickness && a.dash_period == b.dash_period &&
+           a.dash_phase == b.dash_phase && a.dash_on == b.dash_on &&
+           a.dash_cap == b.dash_cap && a.dashed == b.dashed;
+  }
+
+  // Compacts values keeping the first of each group of equal ones, and
+  // returns the new index of each value
+  template <typename T, typename Hash, typename Equal>
+  static vector<int> dedup_values(
+      vector<T>& values, Hash&& hash, Equal&& equal) {
+    auto indices = vector<int>(values.size());
+    auto buckets = std::unordered_multimap<size_t, int>{};
+    auto count   = 0;
+    for (auto idx = 0; idx < (int)values.size(); idx++) {
+      auto key   = hash(values[idx]);
+      auto range = buckets.equal_range(key);
+      auto found = -1;
+      for (auto it = range.first; it != range.second && found < 0; ++it) {
+        if (equal(values[it->second], values[idx])) found = it->second;
+      }
+      if (found >= 0) {
+        indices[idx] = found;
+        continue;
+      }
+      if (count != idx) values[count] = std::move(values[idx]);
+      buckets.insert({key, count});
+      indices[idx] = count++;
+    }
+    values.resize(count);
+    return indices;
+  }
+
+  void dedup_scene(dgram_scene& scene) {
+    auto shapes    = dedup_values(scene.shapes, hash_shape, equal_shapes);
+    auto materials = dedup_values(
+        scene.materials, hash_material, equal_materials);
+    for (auto& object : scene.objects) {
+      if (object.shape >= 0 && object.shape < (int)shapes.size())
+        object.shape = shapes[object.shape];
+      if (object.material >= 0 && object.material < (int)materials.size())
+        object.material = materials[object.material];
+    }
+  }
+
+  void dedup_scenes(dgram_scenes& dgram) {
+    for (auto& scene : dgram.scenes) dedup_scene(scene);
+  }
+
+  void update_label_images(dgram_scene& scene) {
+    for (auto& object : scene.objects) {
+      auto count = object.labels >= 0 && object.labels < scene.labels.size()
+                       ? scene.labels[object.labels].texts.size()
+                       : (size_t)0;
+      object.fields.resize(count);
+    }
+  }
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// FRUSTUM CULLING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  dgram_frustum make_frustum(const dgram_camera& camera, const vec2f& offset,
+      const vec2f& size, const float& scale) {
+    auto aspect = size.x / size.y;
+    auto film   = aspect >= 1 ? vec2f{camera.film, camera.film / aspect}
+                              : vec2f{camera.film * aspect, camera.film};
+
+    auto lens   = camera.lens / size.x * scale;
+    auto center = camera.center * scale / size;
+
+    // image uv range shifted by the scene offset as in trace_sample, padded
+    // to account for pixel rounding
+    auto pad    = 0.01f;
+    auto uv_off = offset * scale * 2 / size;
+    auto uv_min = -uv_off - pad;
+    auto uv_max = 1 - uv_off + pad;
+
+    auto frustum         = dgram_frustum{};
+    frustum.orthographic = camera.orthographic;
+    frustum.frame = inverse(lookat_frame(camera.from, camera.to, {0, 1, 0}));
+
+    auto k = camera.orthographic ? length(camera.from - camera.to) / lens
+                                 : 1 / lens;
+    frustum.min = {film.x * (uv_min.x - 0.5f + center.x) * k,
+        film.y * (0.5f - uv_max.y + center.y) * k};
+    frustum.max = {film.x * (uv_max.x - 0.5f + center.x) * k,
+        film.y * (0.5f - uv_min.y + center.y) * k};
+    return frustum;
+  }
+
+  vec3f project_frustum(const dgram_frustum& frustum, const vec3f& p) {
+    auto camera_p = transform_point(frustum.frame, p);
+    if (frustum.orthographic) return {camera_p.x, camera_p.y, -camera_p.z};
+    if (camera_p.z >= 0) return {0, 0, -camera_p.z};
+    return {camera_p.x / -camera_p.z, camera_p.y / -camera_p.z, -camera_p.z};
+  }
+
+  bool overlap_window(
+      const dgram_frustum& frustum, const bbox3f& bounds, float margin) {
+    if (frustum.orthographic) {
+      if (bounds.max.z < -margin) return false;
+    } else {
+      // perspective projection is only meaningful in front of the camera
+      if (bounds.max.z <= 0) return false;
+      if (bounds.min.z <= 0) return true;
+    }
+    return bounds.max.x >= frustum.min.x - margin &&
+           bounds.min.x <= frustum.max.x + margin &&
+           bounds.max.y >= frustum.min.y - margin &&
+           bounds.min.y <= frustum.max.y + margin;
+  }
+
+  bool overlap_frustum(
+      const dgram_frustum& frustum, const bbox3f& bbox, float margin) {
+    auto bounds = invalidb3f;
+    for (auto corner = 0; corner < 8; corner++) {
+      auto p = vec3f{(corner & 1) ? bbox.max.x : bbox.min.x,
+          (corner & 2) ? bbox.max.y : bbox.min.y,
+          (corner & 4) ? bbox.max.z : bbox.min.z};
+      bounds = merge(bounds, project_frustum(frustum, p));
+    }
+    return overlap_window(frustum, bounds, margin);
+  }
+
+}  // namespace yocto
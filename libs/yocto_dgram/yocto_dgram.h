@@ -37,12 +37,15 @@
 #include <yocto/yocto_image.h>
 #include <yocto/yocto_math.h>
 
+#include <memory>
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
 namespace yocto {
 
   // using directives
+  using std::shared_ptr;
 
 }  // namespace yocto
 
@@ -74,11 +77,31 @@ namespace yocto {
     float film         = 0.036f;
   };
 
+  // Label image cropped to its visible pixels, placed at offset in a frame of
+  // the given size; an empty frame marks a missing image. Pixels are 8-bit
+  // premultiplied sRGB, shared by all the copies of the image. Distance
+  // field images store instead the straight text color, with the signed
+  // distance to the text edges in alpha, and are drawn at any resolution.
+  // Images keep the key of the request they were rasterized for.
+  struct dgram_label_image {
+    int                             width  = 0;
+    int                             height = 0;
+    shared_ptr<const vector<vec4b>> pixels = nullptr;
+    vec2i                           offset = {0, 0};
+    vec2i                           frame  = {0, 0};
+    bool                            sdf    = false;
+    string                          key    = "";
+  };
+
   struct dgram_object {
     frame3f frame    = identity3x4f;
     int     shape    = -1;
     int     material = -1;
     int     labels   = -1;
+
+    // distance fields of the label texts, loaded from the cache, that are
+    // drawn in the stroke color, so they are per object, and at any size
+    vector<dgram_label_image> fields = {};
   };
 
   struct dgram_material {
@@ -119,8 +142,6 @@ namespace yocto {
     vector<string> texts      = {};
     vector<vec2f>  offsets    = {};
     vector<float>  alignments = {};
-
-    vector<image_data> images = {};
   };
 
   struct dgram_scene {
@@ -141,6 +162,46 @@ namespace yocto {
   ray3f eval_camera(const dgram_camera& camera, const vec2f& image_uv,
       const vec2f& size, const float& scale);
 
+  // Merges the identical shapes and materials of each scene, remapping the
+  // objects that use them. Shapes and materials keep their relative order.
+  void dedup_scene(dgram_scene& scene);
+  void dedup_scenes(dgram_scenes& dgram);
+
+  // Sizes the label fields of the objects to the texts of their labels,
+  // keeping the fields they already have
+  void update_label_images(dgram_scene& scene);
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// FRUSTUM CULLING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Region seen by a camera, including the scene offset. The window bounds are
+  // in camera space for orthographic cameras and in view slopes (x/z, y/z)
+  // for perspective ones.
+  struct dgram_frustum {
+    frame3f frame        = identity3x4f;  // world to camera
+    bool    orthographic = true;
+    vec2f   min          = {0, 0};
+    vec2f   max          = {0, 0};
+  };
+
+  dgram_frustum make_frustum(const dgram_camera& camera, const vec2f& offset,
+      const vec2f& size, const float& scale);
+
+  // Projects a point to window coordinates. The z coordinate is the depth in
+  // front of the camera.
+  vec3f project_frustum(const dgram_frustum& frustum, const vec3f& p);
+
+  // Conservative overlap tests, with a margin in window units. The first takes
+  // the bounds of projected points, the second a world-space bounding box.
+  bool overlap_window(
+      const dgram_frustum& frustum, const bbox3f& bounds, float margin);
+  bool overlap_frustum(
+      const dgram_frustum& frustum, const bbox3f& bbox, float margin);
+
 }  // namespace yocto
 
 #endif
\ No newline at end of file
@@ -254,7 +254,8 @@ namespace yocto {
 
     for (auto& point : shape.points) {
       auto& bbox = bboxes.emplace_back();
-      bbox       = point_bounds(shape.positions[point], shape.radii[point] * 3);
+      bbox       = point_bounds(
+          shape.positions[point], eval_radius(shape, point) * 3);
     }
 
     for (auto idx = 0; idx < shape.lines.size(); idx++) {
@@ -262,7 +263,8 @@ namespace yocto {
       auto& end  = shape.ends[idx];
       auto& bbox = bboxes.emplace_back();
       bbox       = line_bounds(shape.positions[line.x], shape.positions[line.y],
-                shape.radii[line.x], shape.radii[line.y], end.a, end.b);
+                eval_radius(shape, line.x), eval_radius(shape, line.y), end.a,
+                end.b);
     }
 
     for (auto& triangle : shape.triangles) {
@@ -280,8 +282,8 @@ namespace yocto {
     for (auto& border : shape.borders) {
       auto& bbox = bboxes.emplace_back();
       bbox = line_bounds(shape.positions[border.x], shape.positions[border.y],
-          shape.radii[border.x], shape.radii[border.y], line_end::cap,
-          line_end::cap);
+          eval_radius(shape, border.x), eval_radius(shape, border.y),
+          line_end::cap, line_end::cap);
     }
 
     build_bvh(bvh.nodes, bvh.primitives, bboxes, highquality);
@@ -371,8 +373,8 @@ namespace yocto {
           auto size = shape.points.size();
           if (prim < size) {
             auto& p = shape.points[i];
-            if (intersect_point(ray, shape.positions[p], shape.radii[p] * 3, uv,
-                    dist, pos, norm)) {
+            if (intersect_point(ray, shape.positions[p],
+                    eval_radius(shape, p) * 3, uv, dist, pos, norm)) {
               if (dist < ray.tmax - ray_eps)
                 intersections.intersections.clear();
               ray.tmax = dist;
@@ -392,23 +394,14 @@ namespace yocto {
             auto& l   = shape.lines[i];
             auto& end = shape.ends[i];
 
-            auto& plane_norm_0     = shape.plane_norms_0[i];
-            auto& plane_norm_1     = shape.plane_norms_1[i];
-            auto& plane_45a_norm_0 = shape.plane_45a_norms_0[i];
-            auto& plane_45a_norm_1 = shape.plane_45a_norms_1[i];
-            auto& plane_45b_norm_0 = shape.plane_45b_norms_0[i];
-            auto& plane_45b_norm_1 = shape.plane_45b_norms_1[i];
-
-            auto& arrow_center0 = shape.arrow_centers0[i];
-            auto& arrow_center1 = shape.arrow_centers1[i];
-            auto& arrow_radius0 = shape.arrow_radii0[i];
-            auto& arrow_radius1 = shape.arrow_radii1[i];
+            auto& arrow = eval_arrow(shape, i);
 
             if (intersect_line(ray, shape.positions[l.x], shape.positions[l.y],
-                    shape.radii[l.x], shape.radii[l.y], end.a, end.b,
-                    plane_norm_0, plane_norm_1, plane_45a_norm_0,
-                    plane_45a_norm_1, plane_45b_norm_0, plane_45b_norm_1,
-                    arrow_center0, arrow_center1, arrow_radius0, arrow_radius1,
+                    eval_radius(shape, l.x), eval_radius(shape, l.y), end.a,
+                    end.b, arrow.plane_norm_0, arrow.plane_norm_1,
+                    arrow.plane_45a_norm_0, arrow.plane_45a_norm_1,
+                    arrow.plane_45b_norm_0, arrow.plane_45b_norm_1,
+                    arrow.center0, arrow.center1, arrow.radius0, arrow.radius1,
                     uv, dist, pos, norm, hit_arrow)) {
               if (dist < ray.tmax - ray_eps)
                 intersections.intersections.clear();
@@ -467,7 +460,8 @@ namespace yocto {
                      prim < size) {
             auto& b = shape.borders[i];
             if (intersect_line(ray, shape.positions[b.x], shape.positions[b.y],
-                    shape.radii[b.x], shape.radii[b.y], uv, dist, pos, norm)) {
+                    eval_radius(shape, b.x), eval_radius(shape, b.y), uv, dist,
+                    pos, norm)) {
               if (dist < ray.tmax - ray_eps)
                 intersections.intersections.clear();
               ray.tmax = dist;
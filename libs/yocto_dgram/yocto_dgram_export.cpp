@@ -0,0 +1,656 @@
+//
+// # Yocto/Dgram export: Vector graphics output
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2021 -- 2022 Simone Bartolini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+// -----------------------------------------------------------------------------
+// INCLUDES
+// -----------------------------------------------------------------------------
+
+#include "yocto_dgram_export.h"
+
+#include <yocto/yocto_color.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#include "ext/base64.h"
+#include "yocto_dgram_shape.h"
+#include "yocto_dgram_text.h"
+#include "yocto_dgramio.h"
+
+// -----------------------------------------------------------------------------
+// USING DIRECTIVES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // using directives
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// DRAWING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Drawing primitives, in diagram units with y pointing down. Polygons and
+  // circles are filled, segments stroked, and images mapped to the
+  // parallelogram of their first, second and last corners.
+  enum struct export_type { polygon, circle, segment, image };
+
+  struct export_item {
+    export_type   type   = export_type::polygon;
+    float         depth  = 0;
+    vec4f         color  = {0, 0, 0, 1};
+    vector<vec2f> points = {};
+    float         width  = 0;          // stroke width or circle radius
+    bool          round  = true;       // round or butt caps
+    vec3f         dashes = {0, 0, 0};  // on, off and offset, if on + off > 0
+    int           image  = -1;
+  };
+
+  struct export_drawing {
+    vec2f                size       = {0, 0};
+    bool                 background = true;
+    vector<export_item>  items      = {};
+    vector<image_data>   images     = {};
+  };
+
+  // Maps world points to diagram units, as seen in a render of a scene
+  struct export_view {
+    dgram_frustum frustum      = {};
+    vec2f         origin       = {0, 0};
+    vec2f         scale        = {0, 0};
+    float         camera_scale = 0;  // image plane units per diagram unit
+  };
+
+  static export_view make_view(const dgram_scene& scene,
+      const dgram_camera& camera, const vec2f& size, float scale) {
+    auto aspect = size.x / size.y;
+    auto film   = aspect >= 1 ? vec2f{camera.film, camera.film / aspect}
+                              : vec2f{camera.film * aspect, camera.film};
+    auto lens   = camera.lens / size.x * scale;
+    auto center = camera.center * scale / size;
+
+    // window coordinates to image uvs as in eval_camera, then shifted by the
+    // scene offset as in trace_sample
+    auto distance = length(camera.from - camera.to);
+    auto k        = camera.orthographic ? distance / lens : 1 / lens;
+    auto view     = export_view{};
+    view.frustum  = make_frustum(camera, scene.offset, size, scale);
+    view.scale    = {size.x / (film.x * k), -size.y / (film.y * k)};
+    view.origin   = vec2f{0.5f - center.x, 0.5f + center.y} * size +
+                  2 * scene.offset * scale;
+    view.camera_scale = camera.orthographic
+                            ? film.x * distance / (camera.lens * scale)
+                            : film.x / size.x;
+    return view;
+  }
+
+  static vec3f project_view(const export_view& view, const vec3f& p) {
+    auto q = project_frustum(view.frustum, p);
+    return {view.origin.x + view.scale.x * q.x,
+        view.origin.y + view.scale.y * q.y, q.z};
+  }
+
+  // Dash pattern of a stroke starting at the given length along the dashed
+  // lines. Round dashes fit their caps within the dash length.
+  static vec3f make_dashes(const dgram_material& material, float offset) {
+    if (material.dashed != dashed_line::always) return zero3f;
+    auto radius = material.thickness / 2;
+    auto on     = material.dash_on;
+    if (material.dash_cap == dash_cap_type::round) on = max(on, 2 * radius);
+    auto period = material.dash_period;
+    if (period < on || period <= 0) return zero3f;
+    if (material.dash_cap == dash_cap_type::square)
+      return {on, period - on, offset + material.dash_phase};
+    return {on - 2 * radius, period - on + 2 * radius,
+        offset + material.dash_phase - radius};
+  }
+
+  // Arrow-heads as traced: triangles are 8 radii long and 16/3 wide, stealth
+  // arrows are 12 radii long and 8 wide, notched at 8 radii
+  static export_item make_arrow(const vec2f& tip, const vec2f& dir,
+      float radius, line_end end, const vec4f& color, float depth) {
+    auto normal = vec2f{-dir.y, dir.x};
+    auto arrow  = export_item{export_type::polygon, depth, color};
+    if (end == line_end::triangle_arrow) {
+      auto base    = tip + dir * 8 * radius;
+      arrow.points = {tip, base + normal * radius * 8 / 3,
+          base - normal * radius * 8 / 3};
+    } else {
+      auto side    = tip + dir * 12 * radius;
+      arrow.points = {tip, side + normal * 4 * radius,
+          tip + dir * 8 * radius, side - normal * 4 * radius};
+    }
+    return arrow;
+  }
+
+  static void add_shape(export_drawing& drawing, const trace_shape& shape,
+      const dgram_material& material, const export_view& view) {
+    auto projected = vector<vec3f>(shape.positions.size());
+    for (auto idx = 0; idx < (int)projected.size(); idx++) {
+      projected[idx] = project_view(view, shape.positions[idx]);
+    }
+    // perspective primitives are dropped if they cross the camera plane
+    auto visible = [&](std::initializer_list<int> vertices) {
+      if (view.frustum.orthographic) return true;
+      for (auto vertex : vertices)
+        if (projected[vertex].z <= 0) return false;
+      return true;
+    };
+    auto point = [&](int vertex) {
+      return vec2f{projected[vertex].x, projected[vertex].y};
+    };
+    // strokes are sorted by the depth of their front, faces by their back
+    auto front = [&](int vertex) {
+      return projected[vertex].z - eval_radius(shape, vertex);
+    };
+    auto back = [&](std::initializer_list<int> vertices) {
+      auto depth = -flt_max;
+      for (auto vertex : vertices) depth = max(depth, projected[vertex].z);
+      return depth;
+    };
+    auto radius = material.thickness / 2;
+
+    // faces
+    auto add_face = [&](std::initializer_list<int> vertices,
+                        const vec4f& color) {
+      if (color.w <= 0 || !visible(vertices)) return;
+      auto& face = drawing.items.emplace_back(
+          export_item{export_type::polygon, back(vertices), color});
+      for (auto vertex : vertices) face.points.push_back(point(vertex));
+    };
+    for (auto& triangle : shape.triangles) {
+      add_face({triangle.x, triangle.y, triangle.z}, material.fill);
+    }
+    for (auto idx = 0; idx < (int)shape.quads.size(); idx++) {
+      auto& quad  = shape.quads[idx];
+      auto  color = shape.fills.empty() ? material.fill : shape.fills[idx];
+      if (quad.z == quad.w) {
+        add_face({quad.x, quad.y, quad.z}, color);
+      } else {
+        add_face({quad.x, quad.y, quad.z, quad.w}, color);
+      }
+    }
+
+    // strokes
+    auto add_segment = [&](const vec2i& line, const line_ends& ends,
+                           float offset) {
+      if (material.stroke.w <= 0 || !visible({line.x, line.y})) return;
+      if (point(line.x) == point(line.y)) return;
+      auto depth   = min(front(line.x), front(line.y));
+      auto start   = point(line.x);
+      auto end     = point(line.y);
+      auto dir     = normalize(end - start);
+      auto segment = export_item{export_type::segment, depth, material.stroke};
+      // arrow-heads replace the ends of the segment, and are not dashed
+      if (ends.a != line_end::cap) {
+        drawing.items.push_back(make_arrow(
+            start, dir, radius, ends.a, material.stroke, depth));
+        start += dir * 8 * radius;
+        offset += 8 * radius;
+      }
+      if (ends.b != line_end::cap) {
+        drawing.items.push_back(
+            make_arrow(end, -dir, radius, ends.b, material.stroke, depth));
+        end -= dir * 8 * radius;
+      }
+      segment.points = {start, end};
+      segment.width  = material.thickness;
+      segment.dashes = make_dashes(material, offset);
+      segment.round  = segment.dashes == zero3f ||
+                      material.dash_cap == dash_cap_type::round;
+      drawing.items.push_back(segment);
+    };
+    auto get_offset = [&](const vector<float>& offsets, int idx) {
+      return offsets.empty() ? 0.0f : offsets[idx] / view.camera_scale;
+    };
+    for (auto idx = 0; idx < (int)shape.borders.size(); idx++) {
+      add_segment(
+          shape.borders[idx], {}, get_offset(shape.border_offsets, idx));
+    }
+    for (auto idx = 0; idx < (int)shape.lines.size(); idx++) {
+      add_segment(shape.lines[idx], shape.ends[idx],
+          get_offset(shape.line_offsets, idx));
+    }
+
+    // points, traced with three times the line radius
+    for (auto vertex : shape.points) {
+      if (material.stroke.w <= 0 || !visible({vertex})) continue;
+      auto  depth  = projected[vertex].z - 3 * eval_radius(shape, vertex);
+      auto& circle = drawing.items.emplace_back(
+          export_item{export_type::circle, depth, material.stroke});
+      circle.points = {point(vertex)};
+      circle.width  = 3 * radius;
+    }
+  }
+
+  // Labels are resampled from the atlas, at the render resolution for
+  // distance fields
+  static void add_text(export_drawing& drawing, const trace_texts& texts,
+      const trace_text& text, const export_view& view) {
+    if (text.size.x == 0 || text.size.y == 0) return;
+    auto corners = vector<vec2f>{};
+    for (auto idx : {0, 1, 3}) {
+      auto p = project_view(view, text.positions[idx]);
+      if (!view.frustum.orthographic && p.z <= 0) return;
+      corners.push_back({p.x, p.y});
+    }
+
+    auto size = text.size;
+    if (text.sdf) {
+      size = {max((int)ceil(text.size.x * text.sdf_scale), 1),
+          max((int)ceil(text.size.y * text.sdf_scale), 1)};
+    }
+    auto image = make_image(size.x, size.y, false);
+    for (auto j = 0; j < image.height; j++) {
+      for (auto i = 0; i < image.width; i++) {
+        auto uv = text.sdf ? vec2f{(i + 0.5f) / image.width,
+                                 (j + 0.5f) / image.height}
+                           : vec2f{(float)i / image.width,
+                                 (float)j / image.height};
+        image.pixels[(size_t)j * image.width + i] = eval_text(texts, text, uv);
+      }
+    }
+
+    auto& item  = drawing.items.emplace_back();
+    item.type   = export_type::image;
+    item.points = corners;
+    item.image  = (int)drawing.images.size();
+    drawing.images.push_back(std::move(image));
+  }
+
+  static export_drawing make_drawing(
+      const dgram_scenes& dgram, const dgram_export_params& params) {
+    auto width  = params.width != 0 ? params.width
+                                    : 2 * (int)round(dgram.size.x);
+    auto aspect = dgram.size.x / dgram.size.y;
+    auto height = (int)round(width / aspect);
+
+    auto drawing       = export_drawing{};
+    drawing.size       = dgram.size;
+    drawing.background = !params.transparent_background;
+    for (auto& scene : dgram.scenes) {
+      auto& camera = scene.cameras[params.camera];
+      auto  view   = make_view(scene, camera, dgram.size, dgram.scale);
+      auto  shapes = make_shapes(scene, params.camera, dgram.size, dgram.scale,
+           params.noparallel);
+      auto  texts  = make_texts(scene, params.camera, dgram.size, dgram.scale,
+           width, height, params.noparallel);
+
+      // scenes are composited in order, their primitives back to front, and
+      // labels over them
+      auto first = drawing.items.size();
+      for (auto& shape : shapes.shapes) {
+        add_shape(drawing, shape, scene.materials[shape.material], view);
+      }
+      std::stable_sort(drawing.items.begin() + first, drawing.items.end(),
+          [](const export_item& a, const export_item& b) {
+            return a.depth > b.depth;
+          });
+      for (auto& text : texts.texts) add_text(drawing, texts, text, view);
+    }
+    return drawing;
+  }
+
+  // Formats numbers with at most two decimals
+  static void format_number(string& str, float value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.2f", value);
+    auto number = string{buffer};
+    while (number.back() == '0') number.pop_back();
+    if (number.back() == '.') number.pop_back();
+    if (number == "-0") number = "0";
+    str += number;
+  }
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// SVG EXPORT
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  static void format_attribute(string& str, const char* name, float value) {
+    str += ' ';
+    str += name;
+    str += "=\"";
+    format_number(str, value);
+    str += '"';
+  }
+
+  static void format_color(
+      string& str, const char* color, const char* opacity, const vec4f& value) {
+    auto rgb = float_to_byte(value);
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "#%02x%02x%02x", rgb.x, rgb.y, rgb.z);
+    str += ' ';
+    str += color;
+    str += "=\"";
+    str += buffer;
+    str += '"';
+    if (value.w < 1) format_attribute(str, opacity, value.w);
+  }
+
+  static void format_path(string& str, const vector<vec2f>& points) {
+    for (auto idx = 0; idx < (int)points.size(); idx++) {
+      str += idx == 0 ? "M" : " L";
+      format_number(str, points[idx].x);
+      str += ' ';
+      format_number(str, points[idx].y);
+    }
+  }
+
+  // Style of a stroked segment
+  static string format_stroke(const export_item& item) {
+    auto style = string{" fill=\"none\""};
+    format_color(style, "stroke", "stroke-opacity", item.color);
+    format_attribute(style, "stroke-width", item.width);
+    style += item.round ? " stroke-linecap=\"round\""
+                        : " stroke-linecap=\"butt\"";
+    if (item.dashes.x + item.dashes.y > 0) {
+      style += " stroke-dasharray=\"";
+      format_number(style, item.dashes.x);
+      style += ' ';
+      format_number(style, item.dashes.y);
+      style += '"';
+      format_attribute(style, "stroke-dashoffset", item.dashes.z);
+    }
+    return style;
+  }
+
+  string make_dgram_svg(
+      const dgram_scenes& dgram, const dgram_export_params& params) {
+    auto drawing = make_drawing(dgram, params);
+
+    auto svg = string{};
+    svg += "<svg xmlns=\"http://www.w3.org/2000/svg\"";
+    svg += " xmlns:xlink=\"http://www.w3.org/1999/xlink\"";
+    format_attribute(svg, "width", drawing.size.x);
+    format_attribute(svg, "height", drawing.size.y);
+    svg += " viewBox=\"0 0 ";
+    format_number(svg, drawing.size.x);
+    svg += ' ';
+    format_number(svg, drawing.size.y);
+    svg += "\">\n";
+    if (drawing.background)
+      svg += "<rect width=\"100%\" height=\"100%\" fill=\"#ffffff\"/>\n";
+
+    // consecutive opaque segments with the same style share a path
+    auto stroke = string{}, path = string{};
+    auto flush  = [&]() {
+      if (path.empty()) return;
+      svg += "<path d=\"" + path + "\"" + stroke + "/>\n";
+      path.clear();
+    };
+    for (auto& item : drawing.items) {
+      if (item.type == export_type::segment) {
+        auto style = format_stroke(item);
+        if (style != stroke || item.color.w < 1) flush();
+        stroke = style;
+        if (!path.empty()) path += ' ';
+        format_path(path, item.points);
+        continue;
+      }
+      flush();
+      if (item.type == export_type::polygon) {
+        svg += "<path d=\"";
+        format_path(svg, item.points);
+        svg += "Z\"";
+        format_color(svg, "fill", "fill-opacity", item.color);
+        svg += "/>\n";
+      } else if (item.type == export_type::circle) {
+        svg += "<circle";
+        format_attribute(svg, "cx", item.points[0].x);
+        format_attribute(svg, "cy", item.points[0].y);
+        format_attribute(svg, "r", item.width);
+        format_color(svg, "fill", "fill-opacity", item.color);
+        svg += "/>\n";
+      } else if (item.type == export_type::image) {
+        auto& image = drawing.images[item.image];
+        auto  png   = make_image_png(image);
+        auto& p0 = item.points[0];
+        auto  e1 = (item.points[1] - p0) / image.width;
+        auto  e3 = (item.points[2] - p0) / image.height;
+        svg += "<image";
+        format_attribute(svg, "width", (float)image.width);
+        format_attribute(svg, "height", (float)image.height);
+        svg += " preserveAspectRatio=\"none\" transform=\"matrix(";
+        for (auto value : {e1.x, e1.y, e3.x, e3.y, p0.x, p0.y}) {
+          if (svg.back() != '(') svg += ' ';
+          // image axes need more precision than positions
+          char buffer[32];
+          snprintf(buffer, sizeof(buffer), "%g", value);
+          svg += buffer;
+        }
+        svg += ")\" xlink:href=\"data:image/png;base64,";
+        svg += base64_encode(png.data(), (unsigned int)png.size());
+        svg += "\"/>\n";
+      }
+    }
+    flush();
+    svg += "</svg>\n";
+    return svg;
+  }
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// PDF EXPORT
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  static void format_point(string& str, const vec2f& point) {
+    format_number(str, point.x);
+    str += ' ';
+    format_number(str, point.y);
+  }
+
+  static void format_color(string& str, const vec4f& color, const char* op) {
+    for (auto value : {color.x, color.y, color.z}) {
+      char buffer[16];
+      snprintf(buffer, sizeof(buffer), "%.3g ", clamp(value, 0.0f, 1.0f));
+      str += buffer;
+    }
+    str += op;
+    str += '\n';
+  }
+
+  // Commands of the page, with opacities set by the graphics states of the
+  // page resources, listed by their alpha
+  static string make_pdf_content(
+      const export_drawing& drawing, vector<float>& alphas) {
+    auto content = string{};
+    content += "1 0 0 -1 0 ";
+    format_number(content, drawing.size.y);
+    content += " cm\n";
+    if (drawing.background) {
+      content += "1 1 1 rg 0 0 ";
+      format_point(content, drawing.size);
+      content += " re f\n";
+    }
+
+    auto alpha       = 1.0f;
+    auto apply_alpha = [&](float value) {
+      if (value == alpha) return;
+      alpha    = value;
+      auto pos = std::find(alphas.begin(), alphas.end(), value);
+      if (pos == alphas.end()) pos = alphas.insert(alphas.end(), value);
+      content += "/GS" + std::to_string(pos - alphas.begin()) + " gs\n";
+    };
+    // circles are approximated by four cubic arcs
+    auto format_circle = [&](const vec2f& center, float radius) {
+      auto k      = 0.5523f * radius;
+      auto corner = [&](vec2f p) {
+        format_point(content, center + p);
+        content += ' ';
+      };
+      corner({radius, 0});
+      content += "m\n";
+      for (auto [a, b] : {pair{vec2f{1, 0}, vec2f{0, 1}},
+               pair{vec2f{0, 1}, vec2f{-1, 0}},
+               pair{vec2f{-1, 0}, vec2f{0, -1}},
+               pair{vec2f{0, -1}, vec2f{1, 0}}}) {
+        corner(a * radius + b * k);
+        corner(b * radius + a * k);
+        corner(b * radius);
+        content += "c\n";
+      }
+    };
+
+    for (auto& item : drawing.items) {
+      if (item.type == export_type::image) {
+        auto& p0 = item.points[0];
+        auto  e1 = item.points[1] - p0;
+        auto  e3 = item.points[2] - p0;
+        // images are mapped to the unit square, with their first row on top
+        apply_alpha(1);
+        content += "q ";
+        auto origin = p0 + e3;
+        for (auto value : {e1.x, e1.y, -e3.x, -e3.y, origin.x, origin.y}) {
+          char buffer[32];
+          snprintf(buffer, sizeof(buffer), "%g ", value);
+          content += buffer;
+        }
+        content += "cm /Im" + std::to_string(item.image) + " Do Q\n";
+        continue;
+      }
+      apply_alpha(item.color.w);
+      if (item.type == export_type::segment) {
+        format_color(content, item.color, "RG");
+        format_number(content, item.width);
+        content += item.round ? " w 1 J [" : " w 0 J [";
+        if (item.dashes.x + item.dashes.y > 0) {
+          auto period = item.dashes.x + item.dashes.y;
+          format_number(content, item.dashes.x);
+          content += ' ';
+          format_number(content, item.dashes.y);
+          content += "] ";
+          auto phase = fmod(item.dashes.z, period);
+          format_number(content, phase < 0 ? phase + period : phase);
+        } else {
+          content += "] 0";
+        }
+        content += " d\n";
+        format_point(content, item.points[0]);
+        content += " m ";
+        format_point(content, item.points[1]);
+        content += " l S\n";
+      } else if (item.type == export_type::polygon) {
+        format_color(content, item.color, "rg");
+        for (auto idx = 0; idx < (int)item.points.size(); idx++) {
+          format_point(content, item.points[idx]);
+          content += idx == 0 ? " m " : " l ";
+        }
+        content += "h f\n";
+      } else if (item.type == export_type::circle) {
+        format_color(content, item.color, "rg");
+        format_circle(item.points[0], item.width);
+        content += "h f\n";
+      }
+    }
+    return content;
+  }
+
+  vector<byte> make_dgram_pdf(
+      const dgram_scenes& dgram, const dgram_export_params& params) {
+    auto drawing = make_drawing(dgram, params);
+    auto alphas  = vector<float>{};
+    auto content = make_pdf_content(drawing, alphas);
+
+    auto pdf     = string{"%PDF-1.4\n%\xe2\xe3\xcf\xd3\n"};
+    auto offsets = vector<size_t>{};
+    auto object  = [&](const string& body) {
+      offsets.push_back(pdf.size());
+      pdf += std::to_string(offsets.size()) + " 0 obj\n" + body +
+             "\nendobj\n";
+    };
+    // streams are compressed
+    auto stream = [&](const string& dict, const vector<byte>& data) {
+      auto zlib = make_zlib(data);
+      return "<<" + dict + " /Filter /FlateDecode /Length " +
+             std::to_string(zlib.size()) + ">>\nstream\n" +
+             string(zlib.begin(), zlib.end()) + "\nendstream";
+    };
+
+    // catalog, page tree, page and its contents, then the images and their
+    // alpha masks
+    auto resources = string{" /ExtGState <<"};
+    for (auto idx = 0; idx < (int)alphas.size(); idx++) {
+      auto alpha = string{};
+      format_number(alpha, alphas[idx]);
+      resources += " /GS" + std::to_string(idx) + " <</ca " + alpha +
+                   " /CA " + alpha + ">>";
+    }
+    resources += ">> /XObject <<";
+    for (auto idx = 0; idx < (int)drawing.images.size(); idx++) {
+      resources += " /Im" + std::to_string(idx) + " " +
+                   std::to_string(5 + 2 * idx) + " 0 R";
+    }
+    resources += ">>";
+    auto media = string{};
+    format_point(media, drawing.size);
+    object("<</Type /Catalog /Pages 2 0 R>>");
+    object("<</Type /Pages /Kids [3 0 R] /Count 1>>");
+    object("<</Type /Page /Parent 2 0 R /MediaBox [0 0 " + media +
+           "] /Resources <<" + resources + ">> /Contents 4 0 R>>");
+    object(stream("", vector<byte>(content.begin(), content.end())));
+    for (auto idx = 0; idx < (int)drawing.images.size(); idx++) {
+      auto& image = drawing.images[idx];
+      auto  rgb = vector<byte>{}, alpha = vector<byte>{};
+      rgb.reserve(image.pixels.size() * 3);
+      alpha.reserve(image.pixels.size());
+      for (auto& pixel : make_image_bytes(image)) {
+        rgb.insert(rgb.end(), {pixel.x, pixel.y, pixel.z});
+        alpha.push_back(pixel.w);
+      }
+      auto size = " /Width " + std::to_string(image.width) + " /Height " +
+                  std::to_string(image.height) + " /BitsPerComponent 8";
+      object(stream(" /Type /XObject /Subtype /Image" + size +
+                        " /ColorSpace /DeviceRGB /SMask " +
+                        std::to_string(6 + 2 * idx) + " 0 R",
+          rgb));
+      object(stream(
+          " /Type /XObject /Subtype /Image" + size + " /ColorSpace /DeviceGray",
+          alpha));
+    }
+
+    // cross-reference table
+    auto xref = pdf.size();
+    pdf += "xref\n0 " + std::to_string(offsets.size() + 1) + "\n";
+    pdf += "0000000000 65535 f \n";
+    for (auto offset : offsets) {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%010zu 00000 n \n", offset);
+      pdf += buffer;
+    }
+    pdf += "trailer\n<</Size " + std::to_string(offsets.size() + 1) +
+           " /Root 1 0 R>>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n";
+    return vector<byte>(pdf.begin(), pdf.end());
+  }
+
+}  // namespace yocto
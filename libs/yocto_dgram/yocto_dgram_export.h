@@ -0,0 +1,73 @@
+//
+// # Yocto/Dgram export: Vector graphics output
+//
+
+//
+// LICENSE:
+//
+// Copyright (c) 2021 -- 2022 Simone Bartolini
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef _YOCTO_DGRAM_EXPORT_H_
+#define _YOCTO_DGRAM_EXPORT_H_
+
+// -----------------------------------------------------------------------------
+// INCLUDES
+// -----------------------------------------------------------------------------
+
+#include "yocto_dgram.h"
+
+// -----------------------------------------------------------------------------
+// USING DIRECTIVES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // using directives
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// VECTOR EXPORT
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Export options. Labels are embedded as images with the resolution they
+  // have in a render of the given width, twice the diagram width by default.
+  struct dgram_export_params {
+    int  camera                 = 0;
+    int  width                  = 0;
+    bool transparent_background = false;
+    bool noparallel             = false;
+  };
+
+  // Exports all the scenes of a diagram as vector graphics, composited in
+  // order as in trace_image, in diagram units. The primitives of each scene
+  // are drawn back to front, which approximates the visibility of a render;
+  // lines dashed only behind transparent faces are drawn solid. Label images
+  // should be loaded before exporting.
+  string make_dgram_svg(
+      const dgram_scenes& dgram, const dgram_export_params& params = {});
+  vector<byte> make_dgram_pdf(
+      const dgram_scenes& dgram, const dgram_export_params& params = {});
+
+}  // namespace yocto
+
+#endif
@@ -38,10 +38,13 @@
 
 #include <glad/glad.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <future>
 #include <stdexcept>
+#include <unordered_set>
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -169,15 +172,39 @@ namespace yocto {
     int material = 0;
   };
 
+  // Label image received from the text server
+  struct label_update {
+    int               scene  = 0;
+    int               object = 0;
+    int               index  = 0;
+    string            key    = "";  // key of the request
+    dgram_label_image image  = {};
+  };
+
+  // Texts with new label images, waiting to be swapped in by the renderer,
+  // and the texts covering the regions to render again
+  struct texts_update {
+    bool               valid   = false;
+    trace_texts        texts   = {};
+    trace_texts        regions = {};
+  };
+
+  static text_request get_text_request(const dgram_scene& scene,
+      const int object, const int index, const dgram_trace_params& params) {
+    return make_text_request(
+        scene, object, index, params.size, params.width, params.height);
+  }
+
   void show_dgram_gui(dgram_scenes& dgram, dgram_trace_params& params,
       bool transparent_background) {
     auto shapes_v = vector<trace_shapes>(dgram.scenes.size());
     auto texts_v  = vector<trace_texts>(dgram.scenes.size());
     auto bvh_v    = vector<dgram_scene_bvh>(dgram.scenes.size());
+    auto shapes_c = vector<shapes_cache>(dgram.scenes.size());
+    auto texts_c  = vector<texts_cache>(dgram.scenes.size());
     auto state_v  = vector<dgram_trace_state>(dgram.scenes.size());
 
     auto needs_rendering = vector<bool>(dgram.scenes.size(), true);
-    auto text_edited     = true;
 
     auto renders = vector<image_data>(
         dgram.scenes.size(), make_image(params.width, params.height, false));
@@ -191,35 +218,213 @@ namespace yocto {
     auto render_update  = std::atomic<bool>{};
     auto render_current = std::atomic<int>{};
     auto render_mutex   = std::mutex{};
-    auto render_worker  = std::future<void>{};
+    auto render_workers = vector<std::future<void>>(dgram.scenes.size());
+    auto render_running = vector<bool>(dgram.scenes.size(), false);
     auto render_stop    = std::atomic<bool>{};
-    auto reset_display  = [&]() {
-      // stop render
+    auto texts_updates  = vector<texts_update>(dgram.scenes.size());
+
+    // label images, requested in the background. Images keep the key of
+    // their request, so that only the edited labels are requested again.
+    auto label_requested = std::unordered_set<string>{};
+    auto label_mutex     = std::mutex{};
+    auto label_updates   = vector<label_update>{};
+    auto label_workers   = vector<std::future<void>>{};
+    auto label_stop      = std::atomic<bool>{};
+
+    // renders the samples left, swapping in the texts with new label images
+    // as they come
+    auto start_render = [&](int idx) {
+      render_workers[idx] = std::async(std::launch::async, [&, idx]() {
+        auto& scene  = dgram.scenes[idx];
+        auto& render = renders[idx];
+        auto& shapes = shapes_v[idx];
+        auto& bvh    = bvh_v[idx];
+        auto& texts  = texts_v[idx];
+        auto& state  = state_v[idx];
+        while (true) {
+          auto regions = trace_texts{};
+          auto retrace = false;
+          {
+            auto  lock   = std::lock_guard{render_mutex};
+            auto& update = texts_updates[idx];
+            auto  done   = !update.valid && state.samples >= params.samples;
+            if (render_stop || done) {
+              render_running[idx] = false;
+              return;
+            }
+            if (update.valid) {
+              texts   = std::move(update.texts);
+              regions = std::move(update.regions);
+              retrace = true;
+              update  = {};
+            }
+          }
+
+          if (retrace) {
+            retrace_texts(state, scene, shapes, texts, bvh, regions, params);
+          } else {
+            parallel_for(state.width, state.height, [&](int i, int j) {
+              if (render_stop) return;
+              trace_sample(state, scene, shapes, texts, bvh, i, j, params);
+            });
+            // an interrupted sample is left uncounted, so the render restarts
+            if (render_stop) continue;
+            state.samples++;
+          }
+
+          if (!render_stop) {
+            auto lock      = std::lock_guard{render_mutex};
+            render_current = state.samples;
+            get_render(render, state);
+            render_update = true;
+          }
+        }
+      });
+    };
+
+    // stop render
+    auto stop_render = [&]() {
       render_stop = true;
-      if (render_worker.valid()) render_worker.get();
+      for (auto& worker : render_workers)
+        if (worker.valid()) worker.get();
+      render_stop = false;
+    };
+
+    // requests the labels without an image for their content and size
+    auto request_labels = [&](int idx) {
+      label_workers.erase(
+          std::remove_if(label_workers.begin(), label_workers.end(),
+              [](const std::future<void>& worker) {
+                return worker.wait_for(std::chrono::seconds(0)) ==
+                       std::future_status::ready;
+              }),
+          label_workers.end());
+
+      auto& scene    = dgram.scenes[idx];
+      auto  requests = vector<text_request>{};
+      auto  updates  = vector<label_update>{};
+      auto  size     = get_text_size(params.size);
+      update_label_images(scene);
+      update_texts_cache(scene, texts_c[idx]);
+      for (auto i = 0; i < scene.objects.size(); i++) {
+        auto& object = scene.objects[i];
+        if (object.labels == -1) continue;
+        auto& label = scene.labels[object.labels];
+        for (auto j = 0; j < label.texts.size(); j++) {
+          if (is_plain_text(label.texts[j])) continue;
+          // cached distance fields are drawn at any resolution
+          auto request = get_text_request(scene, i, j, params);
+          auto key     = make_text_key(request);
+          auto field   = make_text_key(make_text_request(
+              scene, i, j, params.size, size.x, size.y));
+          if (texts_c[idx].images[i][j].key == key ||
+              object.fields[j].key == field)
+            continue;
+          if (!label_requested.insert(key).second) continue;
+          requests.push_back(request);
+          updates.push_back({idx, i, j, key, {}});
+        }
+      }
+      if (requests.empty()) return;
+
+      // a failed request leaves the placeholder
+      label_workers.push_back(std::async(std::launch::async,
+          [&label_updates, &label_mutex, &label_stop, requests,
+              updates]() mutable {
+            auto error = string{};
+            make_text_pngs(
+                requests,
+                [&](int idx, const vector<byte>& png, string& error) {
+                  if (label_stop) return false;
+                  auto& update = updates[idx];
+                  if (!decode_label_image(png, update.image)) return true;
+                  update.image.key = update.key;
+                  auto lock = std::lock_guard{label_mutex};
+                  label_updates.push_back(std::move(update));
+                  return true;
+                },
+                {}, error);
+          }));
+    };
+
+    // swaps in the label images that arrived, rendering again their regions
+    auto apply_labels = [&]() {
+      auto updates = vector<label_update>{};
+      {
+        auto lock = std::lock_guard{label_mutex};
+        std::swap(updates, label_updates);
+      }
+      auto changed = vector<vector<vec2i>>(dgram.scenes.size());
+      for (auto& update : updates) {
+        // labels edited again while requested
+        auto& scene  = dgram.scenes[update.scene];
+        auto& images = texts_c[update.scene].images;
+        if (scene.objects[update.object].labels == -1 ||
+            update.index >= images[update.object].size() ||
+            make_text_key(get_text_request(scene, update.object, update.index,
+                params)) != update.key)
+          continue;
+        images[update.object][update.index] = update.image;
+        changed[update.scene].push_back({update.object, update.index});
+      }
 
       for (auto idx = 0; idx < dgram.scenes.size(); idx++) {
-        if (needs_rendering[idx]) {
-          needs_rendering[idx] = false;
+        if (changed[idx].empty()) continue;
+        auto& scene      = dgram.scenes[idx];
+        auto  texts      = make_texts(scene, texts_c[idx], params.camera,
+                  params.size, params.scale, params.width, params.height,
+                  params.noparallel);
+        auto  regions    = trace_texts{};
+        auto  is_changed = [&](const trace_text& text) {
+          return std::find(changed[idx].begin(), changed[idx].end(),
+                     vec2i{text.object, text.index}) != changed[idx].end();
+        };
+        auto  lock     = std::unique_lock{render_mutex};
+        auto& update   = texts_updates[idx];
+        auto& previous = update.valid ? update.texts : texts_v[idx];
+        for (auto& text : previous.texts)
+          if (is_changed(text)) regions.texts.push_back(text);
+        for (auto& text : texts.texts)
+          if (is_changed(text)) regions.texts.push_back(text);
+        update.valid = true;
+        update.texts = std::move(texts);
+        update.regions.texts.insert(update.regions.texts.end(),
+            regions.texts.begin(), regions.texts.end());
+        if (render_running[idx]) continue;
+        render_running[idx] = true;
+        lock.unlock();
+        start_render(idx);
+      }
+    };
 
-          auto& scene  = dgram.scenes[idx];
-          auto& render = renders[idx];
-          auto& shapes = shapes_v[idx];
-          auto& bvh    = bvh_v[idx];
-          auto& texts  = texts_v[idx];
-          auto& state  = state_v[idx];
+    auto reset_display = [&]() {
+      for (auto idx = 0; idx < dgram.scenes.size(); idx++) {
+        auto& scene  = dgram.scenes[idx];
+        auto& render = renders[idx];
+        auto& shapes = shapes_v[idx];
+        auto& bvh    = bvh_v[idx];
+        auto& texts  = texts_v[idx];
+        auto& state  = state_v[idx];
+
+        if (!needs_rendering[idx]) {
+          // renders stopped by the edits of other scenes are started again,
+          // with the label images that arrived meanwhile
+          auto& update = texts_updates[idx];
+          if (state.samples >= params.samples && !update.valid) continue;
+          if (update.valid) texts = std::move(update.texts);
+          state = make_state(params);
+        } else {
+          needs_rendering[idx] = false;
 
-          shapes = make_shapes(scene, params.camera, params.size, params.scale,
-               params.noparallel);
+          shapes = make_shapes(scene, shapes_c[idx], params.camera,
+              params.size, params.scale, params.noparallel);
           bvh    = make_bvh(shapes, true, params.noparallel);
-          texts  = trace_texts{};
+          texts  = make_texts(scene, texts_c[idx], params.camera, params.size,
+               params.scale, params.width, params.height, params.noparallel);
           state  = make_state(params);
 
           render = make_image(params.width, params.height, false);
 
-          render_worker = {};
-          render_stop   = false;
-
           // preview
           auto pparams = params;
           auto pratio  = 8;
@@ -229,47 +434,25 @@ namespace yocto {
           auto pstate     = make_state(pparams);
           trace_samples(pstate, scene, shapes, texts, bvh, pparams);
           auto preview = get_render(pstate);
-          for (auto idx = 0; idx < state.width * state.height; idx++) {
-            auto i = idx % render.width, j = idx / render.width;
-            auto pi            = clamp(i / pratio, 0, preview.width - 1),
-                 pj            = clamp(j / pratio, 0, preview.height - 1);
-            render.pixels[idx] = preview.pixels[pj * preview.width + pi];
-          }
-          {
-            auto lock      = std::lock_guard{render_mutex};
-            render_current = 0;
-            render_update  = true;
-          }
-
-          // start renderer
-          render_worker = std::async(std::launch::async, [&]() {
-            // make texts
-            texts = make_texts(scene, params.camera, params.size, params.scale,
-                 params.width, params.height, params.noparallel, text_edited);
-
-            for (auto sample = 0; sample < params.samples; sample++) {
-              if (render_stop) return;
-              parallel_for(state.width, state.height, [&](int i, int j) {
-                if (render_stop) return;
-                trace_sample(state, scene, shapes, texts, bvh, i, j, params);
-               });
-              state.samples++;
-              if (!render_stop) {
-                auto lock      = std::lock_guard{render_mutex};
-                render_current = state.samples;
-                get_render(render, state);
-                render_update = true;
-              }
-            }
+          parallel_for(render.width, render.height, [&](int i, int j) {
+            auto pi = clamp(i / pratio, 0, preview.width - 1),
+                 pj = clamp(j / pratio, 0, preview.height - 1);
+            render.pixels[j * render.width + i] =
+                preview.pixels[pj * preview.width + pi];
           });
         }
-      }
-    };
+        {
+          auto lock           = std::lock_guard{render_mutex};
+          texts_updates[idx]  = {};
+          render_running[idx] = true;
+          render_current      = 0;
+          render_update       = true;
+        }
 
-    // stop render
-    auto stop_render = [&]() {
-      render_stop = true;
-      if (render_worker.valid()) render_worker.get();
+        // start renderer, and request the labels meanwhile
+        start_render(idx);
+        request_labels(idx);
+      }
     };
 
     // start rendering
@@ -286,6 +469,9 @@ namespace yocto {
     };
     callbacks.clear = [&](const gui_input& input) { clear_image(glimage); };
     callbacks.draw  = [&](const gui_input& input) {
+      // update labels
+      apply_labels();
+
       // update image
       if (render_update) {
         auto lock = std::lock_guard{render_mutex};
@@ -295,16 +481,23 @@ namespace yocto {
         if (!transparent_background)
           image.pixels = vector<vec4f>(
               params.width * params.height, vec4f{1, 1, 1, 1});
+        // renders are composited in place, upscaling them only if needed
+        auto scaled = image_data{};
         for (auto& render : renders) {
-          auto scaled = make_image(params.width, params.height, false);
-          auto ratio  = params.width / render.width;
-          for (auto idx = 0; idx < params.width * params.height; idx++) {
-            auto i = idx % scaled.width, j = idx / scaled.width;
-            auto pi            = clamp(i / ratio, 0, render.width - 1),
-                 pj            = clamp(j / ratio, 0, render.height - 1);
-            scaled.pixels[idx] = render.pixels[pj * render.width + pi];
+          auto ratio = params.width / render.width;
+          if (ratio == 1 && render.height == params.height) {
+            composite_image_mt(image, render, image);
+            continue;
           }
-          image = composite_image(scaled, image);
+          if (scaled.pixels.empty())
+            scaled = make_image(params.width, params.height, false);
+          parallel_for(scaled.width, scaled.height, [&](int i, int j) {
+            auto pi = clamp(i / ratio, 0, render.width - 1),
+                 pj = clamp(j / ratio, 0, render.height - 1);
+            scaled.pixels[j * scaled.width + i] =
+                render.pixels[pj * render.width + pi];
+          });
+          composite_image_mt(image, scaled, image);
         }
 
         set_image(glimage, image);
@@ -316,7 +509,6 @@ namespace yocto {
     callbacks.widgets = [&](const gui_input& input) {
       auto one_edited = 0;
       auto all_edited = 0;
-      text_edited     = false;
 
       auto current = (int)render_current;
       draw_gui_progressbar("sample", current, params.samples);
@@ -329,10 +521,7 @@ namespace yocto {
           tparams.height = (int)round(
               (float)tparams.width * params.size.y / params.size.x);
         }
-        if (ImGui::IsItemDeactivated()) {
-          text_edited = true;
-          all_edited++;
-        }
+        all_edited += ImGui::IsItemDeactivated();
 
         draw_gui_slider("samples", tparams.samples, 1, 100);
         all_edited += ImGui::IsItemDeactivated();
@@ -355,16 +544,10 @@ namespace yocto {
           tparams.height = (int)round(
               (float)tparams.width * dgram.size.y / dgram.size.x);
         }
-        if (ImGui::IsItemDeactivated()) {
-          text_edited = true;
-          all_edited++;
-        }
+        all_edited += ImGui::IsItemDeactivated();
         if (draw_gui_slider("scale", dgram.scale, 0.1f, 1000.0f))
           tparams.scale = dgram.scale;
-        if (ImGui::IsItemDeactivated()) {
-          text_edited = true;
-          all_edited++;
-        }
+        all_edited += ImGui::IsItemDeactivated();
 
         end_gui_header();
       }
@@ -498,10 +681,7 @@ namespace yocto {
           one_edited += ImGui::IsItemDeactivated();
 
           draw_gui_textinput("text", labels.texts[selection.label]);
-          if (ImGui::IsItemDeactivated()) {
-            text_edited = true;
-            one_edited++;
-          }
+          one_edited += ImGui::IsItemDeactivated();
 
           auto alignments = vector<string>{"left", "center", "right"};
           auto idx        = 1;
@@ -510,10 +690,7 @@ namespace yocto {
           else if (labels.alignments[selection.label] < 0)
             idx = 2;
 
-          if (draw_gui_combobox("alignment", idx, alignments)) {
-            text_edited = true;
-            one_edited++;
-          }
+          one_edited += draw_gui_combobox("alignment", idx, alignments);
 
           if (idx == 0)
             labels.alignments[selection.label] = 1.0f;
@@ -551,6 +728,10 @@ namespace yocto {
     };
 
     show_gui_window({1280 + 320, 720}, "dgram", callbacks);
+
+    // stop the workers
+    label_stop = true;
+    stop_render();
   }
 
 }  // namespace yocto
@@ -35,6 +35,7 @@
 #include <yocto/yocto_geometry.h>
 #include <yocto/yocto_shape.h>
 
+#include <algorithm>
 #include <future>
 
 #include "yocto_dgram_geometry.h"
@@ -88,32 +89,155 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  // Computes ordered triangle mesh boundary
-  static vector<vec2i> get_boundary(vector<vec3i> triangles, int num_vertices) {
-    auto boundary   = vector<vec2i>{};
-    auto adiac      = face_adjacencies(triangles);
-    auto ord_bounds = ordered_boundaries(triangles, adiac, num_vertices);
-    if (!ord_bounds.empty()) {
-      auto ord_bound = ord_bounds[0];
-      for (auto idx = 0; idx < ord_bound.size() - 1; idx++) {
-        boundary.push_back(vec2i{ord_bound[idx], ord_bound[idx + 1]});
+  // Edges of a mesh, each stored once in first-seen order with the
+  // orientation of the first face that uses it, and the number of faces
+  // sharing it.
+  struct edge_counts {
+    vector<vec2i> edges  = {};
+    vector<int>   counts = {};
+  };
+
+  // Counts the faces adjacent to each edge using a hash map on the sorted
+  // edge vertices. Quads are used directly, degenerate quads as triangles.
+  static edge_counts count_edges(
+      const shape_view<vec3i>& triangles, const shape_view<vec4i>& quads) {
+    auto counts = edge_counts{};
+    auto emap   = unordered_map<vec2i, int>{};
+    emap.reserve(triangles.size() * 3 + quads.size() * 4);
+    counts.edges.reserve(triangles.size() * 3 / 2 + quads.size() * 2 + 1);
+    counts.counts.reserve(triangles.size() * 3 / 2 + quads.size() * 2 + 1);
+
+    auto insert_edge = [&](int a, int b) {
+      auto key              = a < b ? vec2i{a, b} : vec2i{b, a};
+      auto [iterator, inew] = emap.try_emplace(key, (int)counts.edges.size());
+      if (inew) {
+        counts.edges.push_back({a, b});
+        counts.counts.push_back(1);
+      } else {
+        counts.counts[iterator->second] += 1;
       }
-      boundary.push_back(vec2i{ord_bound[ord_bound.size() - 1], ord_bound[0]});
+    };
+
+    for (auto& t : triangles) {
+      insert_edge(t.x, t.y);
+      insert_edge(t.y, t.z);
+      insert_edge(t.z, t.x);
+    }
+    for (auto& q : quads) {
+      insert_edge(q.x, q.y);
+      insert_edge(q.y, q.z);
+      if (q.z != q.w) insert_edge(q.z, q.w);
+      insert_edge(q.w, q.x);
     }
 
-    return boundary;
+    return counts;
   }
 
-  // Computes ordered quad mesh boundary
-  static vector<vec2i> get_boundary(vector<vec4i> quads, int num_vertices) {
-    auto triangles = quads_to_triangles(quads);
-    return get_boundary(triangles, num_vertices);
+  // Computes all mesh edges, with the lower vertex index first
+  static vector<vec2i> make_edges(
+      const shape_view<vec3i>& triangles, const shape_view<vec4i>& quads) {
+    auto counts = count_edges(triangles, quads);
+    for (auto& edge : counts.edges) {
+      if (edge.x > edge.y) edge = {edge.y, edge.x};
+    }
+    return std::move(counts.edges);
+  }
+
+  // Computes all mesh boundaries as ordered loops, concatenated. Loops start
+  // from their lowest vertex and follow the faces orientation. Open chains,
+  // found on non-manifold meshes, are kept as they are.
+  static vector<vec2i> make_boundaries(const shape_view<vec3i>& triangles,
+      const shape_view<vec4i>& quads, int num_vertices) {
+    auto counts = count_edges(triangles, quads);
+
+    // map every boundary vertex to its next one
+    auto next_vert = vector<int>(num_vertices, -1);
+    auto has_prev  = vector<bool>(num_vertices, false);
+    auto num_edges = 0;
+    for (auto idx = 0; idx < counts.edges.size(); idx++) {
+      if (counts.counts[idx] != 1) continue;
+      auto& edge        = counts.edges[idx];
+      next_vert[edge.x] = edge.y;
+      has_prev[edge.y]  = true;
+      num_edges += 1;
+    }
+
+    auto boundaries = vector<vec2i>{};
+    boundaries.reserve(num_edges);
+
+    auto follow_boundary = [&](int start) {
+      auto current = start;
+      while (next_vert[current] != -1) {
+        auto next          = next_vert[current];
+        next_vert[current] = -1;
+        boundaries.push_back({current, next});
+        current = next;
+      }
+    };
+
+    // open chains first, so that they are not split, then closed loops
+    for (auto vert = 0; vert < num_vertices; vert++) {
+      if (next_vert[vert] != -1 && !has_prev[vert]) follow_boundary(vert);
+    }
+    for (auto vert = 0; vert < num_vertices; vert++) {
+      if (next_vert[vert] != -1) follow_boundary(vert);
+    }
+
+    return boundaries;
+  }
+
+  // Borders of all the faces of a shape
+  static vector<vec2i> make_borders(const dgram_shape& shape) {
+    auto triangles = borrow_view(shape.triangles);
+    auto quads     = borrow_view(shape.quads);
+    return shape.boundary ? make_boundaries(triangles, quads,
+                                (int)shape.positions.size())
+                          : make_edges(triangles, quads);
+  }
+
+  // Updates the borders of a shape, unless they were made from the same faces
+  static void update_borders(const dgram_shape& shape, shape_borders& cached) {
+    if (cached.borders && cached.boundary == shape.boundary &&
+        cached.vertices == (int)shape.positions.size() &&
+        cached.triangles == shape.triangles && cached.quads == shape.quads)
+      return;
+    cached.boundary  = shape.boundary;
+    cached.vertices  = (int)shape.positions.size();
+    cached.triangles = shape.triangles;
+    cached.quads     = shape.quads;
+    cached.borders   = std::make_shared<vector<vec2i>>(make_borders(shape));
+  }
+
+  // Culling margin, in frustum window units, covering points and arrow heads
+  static float frustum_margin(const dgram_material& material,
+      const float camera_distance, const bool orthographic, const vec2f& film,
+      const float lens, const vec2f& size, const float scale) {
+    auto radius = orthographic ? material.thickness * film.x * camera_distance /
+                                     (2 * lens * scale)
+                               : material.thickness * film.x / (2 * size.x);
+    auto plane_distance = -lens * scale / size.x;
+    return 3 * (orthographic ? radius : radius / abs(plane_distance));
+  }
+
+  // Keeps the values for which `keep` is true, taking the index. Returns the
+  // same view, without copies, if all values are kept.
+  template <typename T, typename Func>
+  static shape_view<T> filter_view(const shape_view<T>& values, Func&& keep) {
+    auto first = (size_t)0;
+    while (first < values.size() && keep((int)first)) first++;
+    if (first == values.size()) return values;
+    auto kept = vector<T>(values.begin(), values.begin() + first);
+    for (auto idx = first + 1; idx < values.size(); idx++) {
+      if (keep((int)idx)) kept.push_back(values[idx]);
+    }
+    return own_view(std::move(kept));
   }
 
   trace_shape make_shape(const dgram_scene& scene, const dgram_object& object,
-      const frame3f& camera_frame, const float camera_distance,
-      const bool orthographic, const vec2f& film, const float lens,
-      const vec2f& size, const float scale) {
+      const shared_ptr<vector<vec2i>>& all_borders,
+      const dgram_frustum& frustum, const frame3f& camera_frame,
+      const float camera_distance, const bool orthographic, const vec2f& film,
+      const float lens, const vec2f& size, const float scale) {
     auto shape = trace_shape{};
 
     auto& dshape   = scene.shapes[object.shape];
@@ -124,15 +248,26 @@ namespace yocto {
                                : material.thickness * film.x / (2 * size.x);
     auto plane_distance = -lens * scale / size.x;
 
-    for (auto& pos : dshape.positions) {
-      // position
-      auto& p = shape.positions.emplace_back();
-      p       = transform_point(object.frame, pos);
+    // dash offsets are stored only if the material can be dashed
+    auto dashed = material.dashed != dashed_line::never;
 
-      // radius
-      if (orthographic)
-        shape.radii.push_back(radius);
-      else {
+    // positions, borrowed if the object is not transformed
+    if (object.frame == identity3x4f) {
+      shape.positions = borrow_view(dshape.positions);
+    } else {
+      auto positions = vector<vec3f>{};
+      positions.reserve(dshape.positions.size());
+      for (auto& pos : dshape.positions) {
+        positions.push_back(transform_point(object.frame, pos));
+      }
+      shape.positions = own_view(std::move(positions));
+    }
+
+    // radii, shared by all vertices for orthographic cameras
+    shape.radius = radius;
+    if (!orthographic) {
+      shape.radii.reserve(shape.positions.size());
+      for (auto& p : shape.positions) {
         // compuing world-space radius from screen-space radius using triangles
         // similarities
         auto camera_p = transform_point(inverse(camera_frame), p);
@@ -141,81 +276,113 @@ namespace yocto {
       }
     }
 
-    shape.points = dshape.points;
-
-    shape.lines = dshape.lines;
-    shape.ends  = dshape.ends;
+    // projecting positions to cull primitives outside of the frustum
+    auto margin = frustum_margin(material, camera_distance, orthographic, film,
+        lens, size, scale);
+    auto projected = vector<vec3f>(shape.positions.size());
+    for (auto idx = 0; idx < shape.positions.size(); idx++) {
+      projected[idx] = project_frustum(frustum, shape.positions[idx]);
+    }
+    auto visible = [&](std::initializer_list<int> vertices) {
+      auto bounds = invalidb3f;
+      for (auto vertex : vertices) bounds = merge(bounds, projected[vertex]);
+      return overlap_window(frustum, bounds, margin);
+    };
 
     shape.material = object.material;
 
-    // triangles
-    if (!dshape.triangles.empty()) {
-      if (!dshape.cull)
-        shape.triangles = dshape.triangles;
-      else {
-        // culling triangles
-        for (auto& triangle : dshape.triangles) {
-          auto p0 = shape.positions[triangle.x];
-          auto p1 = shape.positions[triangle.y];
-          auto p2 = shape.positions[triangle.z];
-
-          auto dir = camera_frame.z;
-          if (!orthographic) {
-            auto fcenter = (p0 + p1 + p2) / 3;
-            dir          = camera_frame.o - fcenter;
-          }
-
-          if (dot(dir, cross(p1 - p0, p2 - p0)) <= 0) continue;
-          shape.triangles.push_back(triangle);
-        }
+    // points
+    shape.points = filter_view(borrow_view(dshape.points),
+        [&](int idx) { return visible({dshape.points[idx]}); });
+
+    // culling back faces
+    auto front_triangle = [&](int idx) {
+      auto& triangle = dshape.triangles[idx];
+      auto  p0       = shape.positions[triangle.x];
+      auto  p1       = shape.positions[triangle.y];
+      auto  p2       = shape.positions[triangle.z];
+
+      auto dir = camera_frame.z;
+      if (!orthographic) {
+        auto fcenter = (p0 + p1 + p2) / 3;
+        dir          = camera_frame.o - fcenter;
+      }
+
+      return dot(dir, cross(p1 - p0, p2 - p0)) > 0;
+    };
+    auto front_quad = [&](int idx) {
+      auto& quad = dshape.quads[idx];
+      auto  p0   = shape.positions[quad.x];
+      auto  p1   = shape.positions[quad.y];
+      auto  p2   = shape.positions[quad.z];
+      auto  p3   = shape.positions[quad.w];
+
+      auto dir = camera_frame.z;
+      if (!orthographic) {
+        auto fcenter = (p0 + p1 + p2 + p3) / 4;
+        dir          = camera_frame.o - fcenter;
       }
 
-      // computing triangles borders
-      auto borders = dshape.boundary ? get_boundary(shape.triangles,
-                                           (int)shape.positions.size())
-                                     : get_edges(shape.triangles);
+      return dot(dir, cross(p1 - p0, p2 - p0)) > 0;
+    };
 
-      shape.borders.insert(shape.borders.end(), borders.begin(), borders.end());
+    auto triangles = borrow_view(dshape.triangles);
+    auto quads     = borrow_view(dshape.quads);
+    auto fills     = borrow_view(dshape.fills);
+    if (dshape.cull) {
+      triangles = filter_view(triangles, front_triangle);
+      quads     = filter_view(quads, front_quad);
+      if (!fills.empty()) fills = filter_view(fills, front_quad);
     }
 
-    // quads
-    if (!dshape.quads.empty()) {
-      if (!dshape.cull) {
-        shape.quads = dshape.quads;
-        shape.fills = dshape.fills;
-      } else {
-        // culling quads
-        for (auto idx = 0; idx < dshape.quads.size(); idx++) {
-          auto& quad = dshape.quads[idx];
-          auto  p0   = shape.positions[quad.x];
-          auto  p1   = shape.positions[quad.y];
-          auto  p2   = shape.positions[quad.z];
-          auto  p3   = shape.positions[quad.w];
-
-          auto dir = camera_frame.z;
-          if (!orthographic) {
-            auto fcenter = (p0 + p1 + p2 + p3) / 4;
-            dir          = camera_frame.o - fcenter;
-          }
-
-          if (dot(dir, cross(p1 - p0, p2 - p0)) <= 0) continue;
-          shape.quads.push_back(quad);
-          if (!dshape.fills.empty()) shape.fills.push_back(dshape.fills[idx]);
-        }
+    // borders, shared by the objects of the shape unless the faces were
+    // culled, computed before frustum culling so that they do not depend on
+    // the view
+    auto borders = shape_view<vec2i>{};
+    if (all_borders) borders = share_view(all_borders);
+    if (dshape.cull) {
+      if (!triangles.empty() || !quads.empty()) {
+        borders = own_view(dshape.boundary
+                               ? make_boundaries(triangles, quads,
+                                     (int)shape.positions.size())
+                               : make_edges(triangles, quads));
       }
+    }
 
-      // computing quads borders
-      auto borders = dshape.boundary ? get_boundary(shape.quads,
-                                           (int)shape.positions.size())
-                                     : get_edges(shape.quads);
-
-      shape.borders.insert(shape.borders.end(), borders.begin(), borders.end());
+    // frustum culling faces
+    auto visible_quad = [&](int idx) {
+      auto& quad = quads[idx];
+      return visible({quad.x, quad.y, quad.z, quad.w});
+    };
+    shape.triangles = filter_view(triangles, [&](int idx) {
+      auto& triangle = triangles[idx];
+      return visible({triangle.x, triangle.y, triangle.z});
+    });
+    shape.quads = filter_view(quads, visible_quad);
+    if (!fills.empty()) shape.fills = filter_view(fills, visible_quad);
+
+    // lines, with their dash offsets computed also on the culled ones
+    auto visible_line = [&](int idx) {
+      auto& line = dshape.lines[idx];
+      return visible({line.x, line.y});
+    };
+    shape.lines = filter_view(borrow_view(dshape.lines), visible_line);
+    shape.ends  = filter_view(borrow_view(dshape.ends), visible_line);
+
+    // arrow-heads are stored only if there are any
+    auto has_arrows = false;
+    for (auto& end : shape.ends) {
+      if (end.a != line_end::cap || end.b != line_end::cap) has_arrows = true;
     }
+    if (has_arrows) shape.arrow_ids.reserve(shape.lines.size());
 
-    // arrow dirs
-    for (auto& line : shape.lines) {
-      auto& p0 = shape.positions[line.x];
-      auto& p1 = shape.positions[line.y];
+    // lines are visited only for their dash offsets and arrow-heads
+    auto line_offset = 0.0f;
+    auto line_count  = dashed || has_arrows ? dshape.lines.size() : 0;
+    for (auto idx = 0; idx < line_count; idx++) {
+      auto& line = dshape.lines[idx];
+      auto& p0   = shape.positions[line.x];
+      auto& p1   = shape.positions[line.y];
 
       auto camera_p0 = transform_point(inverse(camera_frame), p0);
       auto camera_p1 = transform_point(inverse(camera_frame), p1);
@@ -230,7 +397,21 @@ namespace yocto {
 
         auto screen_length = distance(screen_p0, screen_p1);
 
-        shape.line_lengths.push_back(screen_length);
+        auto offset = line_offset;
+        line_offset += screen_length;
+        if (!visible_line(idx)) continue;
+
+        if (dashed) shape.line_offsets.push_back(offset);
+
+        // arrow-heads data, only for lines with arrows
+        auto& end = dshape.ends[idx];
+        if (!has_arrows) continue;
+        if (end.a == line_end::cap && end.b == line_end::cap) {
+          shape.arrow_ids.push_back(-1);
+          continue;
+        }
+        shape.arrow_ids.push_back((int)shape.arrows.size());
+        auto& arrow = shape.arrows.emplace_back();
 
         // computing the arrow-heads base centers
         auto camera_arrow_center0 = line_point(
@@ -243,15 +424,15 @@ namespace yocto {
         auto arrow_center1 = transform_point(
             camera_frame, camera_arrow_center1);
 
-        shape.arrow_centers0.push_back(arrow_center0);
-        shape.arrow_centers1.push_back(arrow_center1);
+        arrow.center0 = arrow_center0;
+        arrow.center1 = arrow_center1;
 
         // computing the arrow-heads base radii
         auto arrow_radius0 = radius * 8 / 3;
         auto arrow_radius1 = radius * 8 / 3;
 
-        shape.arrow_radii0.push_back(arrow_radius0);
-        shape.arrow_radii1.push_back(arrow_radius1);
+        arrow.radius0 = arrow_radius0;
+        arrow.radius1 = arrow_radius1;
 
         // computing the truncation planes normals
         auto screen_camera_dir = normalize(screen_camera_p1 - screen_camera_p0);
@@ -263,12 +444,12 @@ namespace yocto {
             camera_frame, vec3f{screen_camera_dir.x - screen_camera_dir.y,
                               screen_camera_dir.y + screen_camera_dir.x, 0});
 
-        shape.plane_norms_0.push_back(screen_dir);
-        shape.plane_45a_norms_0.push_back(screen_dir_45a);
-        shape.plane_45b_norms_0.push_back(screen_dir_45b);
-        shape.plane_norms_1.push_back(-screen_dir);
-        shape.plane_45a_norms_1.push_back(-screen_dir_45a);
-        shape.plane_45b_norms_1.push_back(-screen_dir_45b);
+        arrow.plane_norm_0     = screen_dir;
+        arrow.plane_45a_norm_0 = screen_dir_45a;
+        arrow.plane_45b_norm_0 = screen_dir_45b;
+        arrow.plane_norm_1     = -screen_dir;
+        arrow.plane_45a_norm_1 = -screen_dir_45a;
+        arrow.plane_45b_norm_1 = -screen_dir_45b;
       } else {
         // computing the line scree-space length
         auto screen_camera_p0 = screen_space_point(camera_p0, plane_distance);
@@ -279,7 +460,21 @@ namespace yocto {
 
         auto screen_length = distance(screen_p0, screen_p1);
 
-        shape.line_lengths.push_back(screen_length);
+        auto offset = line_offset;
+        line_offset += screen_length;
+        if (!visible_line(idx)) continue;
+
+        if (dashed) shape.line_offsets.push_back(offset);
+
+        // arrow-heads data, only for lines with arrows
+        auto& end = dshape.ends[idx];
+        if (!has_arrows) continue;
+        if (end.a == line_end::cap && end.b == line_end::cap) {
+          shape.arrow_ids.push_back(-1);
+          continue;
+        }
+        shape.arrow_ids.push_back((int)shape.arrows.size());
+        auto& arrow = shape.arrows.emplace_back();
 
         // computing the arrow-heads base centers
         auto camera_arrow_center0 = perspective_line_point(
@@ -292,8 +487,8 @@ namespace yocto {
         auto arrow_center1 = transform_point(
             camera_frame, camera_arrow_center1);
 
-        shape.arrow_centers0.push_back(arrow_center0);
-        shape.arrow_centers1.push_back(arrow_center1);
+        arrow.center0 = arrow_center0;
+        arrow.center1 = arrow_center1;
 
         // computing the arrow-heads base radii
         auto arrow_radius0 = radius * 8 / 3 *
@@ -301,8 +496,8 @@ namespace yocto {
         auto arrow_radius1 = radius * 8 / 3 *
                              abs(camera_arrow_center1.z / plane_distance);
 
-        shape.arrow_radii0.push_back(arrow_radius0);
-        shape.arrow_radii1.push_back(arrow_radius1);
+        arrow.radius0 = arrow_radius0;
+        arrow.radius1 = arrow_radius1;
 
         // computing the truncation planes normals
         auto screen_camera_dir = normalize(screen_camera_p1 - screen_camera_p0);
@@ -317,89 +512,151 @@ namespace yocto {
         auto ray0 = transform_direction(camera_frame, camera_arrow_center0);
         auto ray1 = transform_direction(camera_frame, camera_arrow_center1);
 
-        shape.plane_norms_0.push_back(orthonormalize(screen_dir, ray0));
-        shape.plane_45a_norms_0.push_back(orthonormalize(screen_dir_45a, ray0));
-        shape.plane_45b_norms_0.push_back(orthonormalize(screen_dir_45b, ray0));
-        shape.plane_norms_1.push_back(orthonormalize(-screen_dir, ray1));
-        shape.plane_45a_norms_1.push_back(
-            orthonormalize(-screen_dir_45a, ray1));
-        shape.plane_45b_norms_1.push_back(
-            orthonormalize(-screen_dir_45b, ray1));
+        arrow.plane_norm_0     = orthonormalize(screen_dir, ray0);
+        arrow.plane_45a_norm_0 = orthonormalize(screen_dir_45a, ray0);
+        arrow.plane_45b_norm_0 = orthonormalize(screen_dir_45b, ray0);
+        arrow.plane_norm_1     = orthonormalize(-screen_dir, ray1);
+        arrow.plane_45a_norm_1 = orthonormalize(-screen_dir_45a, ray1);
+        arrow.plane_45b_norm_1 = orthonormalize(-screen_dir_45b, ray1);
       }
     }
 
-    for (auto& border : shape.borders) {
+    // borders, with their dash offsets computed also on the culled ones
+    auto visible_border = [&](int idx) {
+      auto& border = borders[idx];
+      return visible({border.x, border.y});
+    };
+    shape.borders = filter_view(borders, visible_border);
+
+    auto border_offset = 0.0f;
+    auto border_count  = dashed ? borders.size() : 0;
+    for (auto idx = 0; idx < border_count; idx++) {
+      auto& border = borders[idx];
       auto& p0 = shape.positions[border.x];
       auto& p1 = shape.positions[border.y];
 
       auto camera_p0 = transform_point(inverse(camera_frame), p0);
       auto camera_p1 = transform_point(inverse(camera_frame), p1);
 
+      auto offset = border_offset;
       if (orthographic) {
         auto screen_p0 = transform_point(
             camera_frame, vec3f{camera_p0.x, camera_p0.y, 0});
         auto screen_p1 = transform_point(
             camera_frame, vec3f{camera_p1.x, camera_p1.y, 0});
 
-        shape.border_lengths.push_back(distance(screen_p0, screen_p1));
+        border_offset += distance(screen_p0, screen_p1);
       } else {
         auto screen_p0 = transform_point(
             camera_frame, screen_space_point(camera_p0, plane_distance));
         auto screen_p1 = transform_point(
             camera_frame, screen_space_point(camera_p1, plane_distance));
 
-        shape.border_lengths.push_back(distance(screen_p0, screen_p1));
+        border_offset += distance(screen_p0, screen_p1);
       }
+
+      if (!visible_border(idx)) continue;
+      shape.border_offsets.push_back(offset);
     }
 
     return shape;
   }
 
-  trace_shapes make_shapes(const dgram_scene& scene, const int& cam,
-      const vec2f& size, const float& scale, const bool noparallel) {
+  // Checks if a shape has no primitives left after culling
+  static bool is_empty(const trace_shape& shape) {
+    return shape.points.empty() && shape.lines.empty() &&
+           shape.triangles.empty() && shape.quads.empty() &&
+           shape.borders.empty();
+  }
+
+  // Makes the shapes, with the borders of the cache if given
+  static trace_shapes make_shapes(const dgram_scene& scene,
+      shapes_cache* cache, const int& cam, const vec2f& size,
+      const float& scale, const bool noparallel) {
     auto& camera          = scene.cameras[cam];
     auto  camera_frame    = lookat_frame(camera.from, camera.to, {0, 1, 0});
     auto  camera_distance = length(camera.from - camera.to);
     auto  aspect          = size.x / size.y;
     auto  film = aspect >= 1 ? vec2f{camera.film, camera.film / aspect}
                              : vec2f{camera.film * aspect, camera.film};
+    auto  frustum = make_frustum(camera, scene.offset, size, scale);
 
     auto shapes = trace_shapes{};
 
-    if (noparallel) {
-      for (auto idx = 0; idx < scene.objects.size(); idx++) {
-        auto& object = scene.objects[idx];
-        if (object.shape != -1) {
-          auto shape = make_shape(scene, object, camera_frame, camera_distance,
-              camera.orthographic, film, camera.lens, size, scale);
-          shapes.shapes.push_back(shape);
-        }
+    // culling objects whose transformed bounds are outside of the frustum
+    auto idxs = vector<int>{};
+    for (auto i = 0; i < scene.objects.size(); i++) {
+      auto& object = scene.objects[i];
+      if (object.shape == -1) continue;
+      auto& dshape = scene.shapes[object.shape];
+      auto  bbox   = invalidb3f;
+      for (auto& p : dshape.positions) bbox = merge(bbox, p);
+      bbox        = transform_bbox(object.frame, bbox);
+      auto margin = frustum_margin(scene.materials[object.material],
+          camera_distance, camera.orthographic, film, camera.lens, size, scale);
+      if (overlap_frustum(frustum, bbox, margin)) idxs.push_back(i);
+    }
+
+    // borders of the shapes in use, once per shape
+    auto used = vector<bool>(scene.shapes.size(), false);
+    for (auto idx : idxs) used[scene.objects[idx].shape] = true;
+    auto sidxs = vector<int>{};
+    for (auto idx = 0; idx < scene.shapes.size(); idx++) {
+      if (used[idx] && !scene.shapes[idx].cull) sidxs.push_back(idx);
+    }
+    auto borders = vector<shared_ptr<vector<vec2i>>>(scene.shapes.size());
+    if (cache) cache->shapes.resize(scene.shapes.size());
+    auto get_borders = [&](int idx) {
+      if (cache) {
+        update_borders(scene.shapes[idx], cache->shapes[idx]);
+        borders[idx] = cache->shapes[idx].borders;
+      } else {
+        borders[idx] = std::make_shared<vector<vec2i>>(
+            make_borders(scene.shapes[idx]));
       }
+    };
+    if (noparallel) {
+      for (auto idx : sidxs) get_borders(idx);
     } else {
-      auto idxs = vector<int>{};
+      parallel_for(sidxs.size(), [&](size_t i) { get_borders(sidxs[i]); });
+    }
 
-      for (auto i = 0; i < scene.objects.size(); i++) {
-        auto& object = scene.objects[i];
-        if (object.shape != -1) {
-          idxs.push_back(i);
-        }
+    shapes.shapes.resize(idxs.size());
+    if (noparallel) {
+      for (auto i = 0; i < idxs.size(); i++) {
+        auto& object     = scene.objects[idxs[i]];
+        shapes.shapes[i] = make_shape(scene, object, borders[object.shape],
+            frustum, camera_frame, camera_distance, camera.orthographic, film,
+            camera.lens, size, scale);
       }
-
-      shapes.shapes.resize(idxs.size());
+    } else {
       parallel_for(idxs.size(), [&](size_t i) {
-        auto  idx    = idxs[i];
-        auto& object = scene.objects[idx];
-        if (object.shape != -1) {
-          auto shape = make_shape(scene, object, camera_frame, camera_distance,
-              camera.orthographic, film, camera.lens, size, scale);
-          shapes.shapes[i] = shape;
-        }
+        auto& object     = scene.objects[idxs[i]];
+        shapes.shapes[i] = make_shape(scene, object, borders[object.shape],
+            frustum, camera_frame, camera_distance, camera.orthographic, film,
+            camera.lens, size, scale);
       });
     }
 
+    // removing shapes that were culled entirely
+    shapes.shapes.erase(std::remove_if(shapes.shapes.begin(),
+                            shapes.shapes.end(), is_empty),
+        shapes.shapes.end());
+
     return shapes;
   }
 
+  trace_shapes make_shapes(const dgram_scene& scene, const int& cam,
+      const vec2f& size, const float& scale, const bool noparallel) {
+    return make_shapes(scene, nullptr, cam, size, scale, noparallel);
+  }
+
+  trace_shapes make_shapes(const dgram_scene& scene, shapes_cache& cache,
+      const int& cam, const vec2f& size, const float& scale,
+      const bool noparallel) {
+    return make_shapes(scene, &cache, cam, size, scale, noparallel);
+  }
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -451,9 +708,9 @@ namespace yocto {
 
     auto& lines   = element.primitive == primitive_type::line ? shape.lines
                                                               : shape.borders;
-    auto& lengths = element.primitive == primitive_type::line
-                        ? shape.line_lengths
-                        : shape.border_lengths;
+    auto& offsets = element.primitive == primitive_type::line
+                        ? shape.line_offsets
+                        : shape.border_offsets;
 
     auto& p0 = shape.positions[lines[element.index].x];
     auto& p1 = shape.positions[lines[element.index].y];
@@ -463,10 +720,8 @@ namespace yocto {
     auto camera_p0 = transform_point(inverse(camera_frame), p0);
     auto camera_p1 = transform_point(inverse(camera_frame), p1);
 
-    // summing the lengths of the preceding lines
-    for (auto idx = 0; idx < element.index; idx++) {
-      xp += lengths[idx];
-    }
+    // length of the preceding lines
+    xp += offsets[element.index];
 
     if (camera.orthographic) {
       auto screen_p = transform_point(
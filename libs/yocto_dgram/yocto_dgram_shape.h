@@ -51,34 +51,91 @@ namespace yocto {
 
   enum class primitive_type { point, line, triangle, quad, border };
 
+  // Read-only view of an array, either borrowed from the diagram shape or
+  // owning its storage when the data had to be culled or transformed.
+  template <typename T>
+  struct shape_view {
+    const T*              data    = nullptr;
+    size_t                count   = 0;
+    shared_ptr<vector<T>> storage = nullptr;
+
+    size_t   size() const { return count; }
+    bool     empty() const { return count == 0; }
+    const T* begin() const { return data; }
+    const T* end() const { return data + count; }
+    const T& operator[](size_t idx) const { return data[idx]; }
+  };
+
+  // Views that borrow values, which must outlive the view, or own them,
+  // alone or shared with other views
+  template <typename T>
+  inline shape_view<T> borrow_view(const vector<T>& values) {
+    return {values.data(), values.size(), nullptr};
+  }
+  template <typename T>
+  inline shape_view<T> share_view(const shared_ptr<vector<T>>& storage) {
+    return {storage->data(), storage->size(), storage};
+  }
+  template <typename T>
+  inline shape_view<T> own_view(vector<T>&& values) {
+    return share_view(std::make_shared<vector<T>>(std::move(values)));
+  }
+
+  // Arrow-heads base centers and radii, and truncation planes normals
+  struct line_arrow {
+    vec3f plane_norm_0     = {0, 0, 0};
+    vec3f plane_norm_1     = {0, 0, 0};
+    vec3f plane_45a_norm_0 = {0, 0, 0};
+    vec3f plane_45a_norm_1 = {0, 0, 0};
+    vec3f plane_45b_norm_0 = {0, 0, 0};
+    vec3f plane_45b_norm_1 = {0, 0, 0};
+    vec3f center0          = {0, 0, 0};
+    vec3f center1          = {0, 0, 0};
+    float radius0          = 0;
+    float radius1          = 0;
+  };
+
+  // Trace shapes reference the topology of the diagram shapes they are built
+  // from, so the diagram scene must outlive them.
   struct trace_shape {
-    vector<vec3f> positions = {};
-
-    vector<int>   points    = {};
-    vector<vec2i> lines     = {};
-    vector<vec3i> triangles = {};
-    vector<vec4i> quads     = {};
-    vector<vec2i> borders   = {};
-
-    vector<vec4f>     fills            = {};
-    vector<line_ends> ends             = {};
-    vector<float>     radii            = {};
-    vector<vec3f>     plane_norms_0     = {};
-    vector<vec3f>     plane_norms_1     = {};
-    vector<vec3f>     plane_45a_norms_0 = {};
-    vector<vec3f>     plane_45a_norms_1 = {};
-    vector<vec3f>     plane_45b_norms_0 = {};
-    vector<vec3f>     plane_45b_norms_1 = {};
-    vector<float>     arrow_radii0     = {};
-    vector<float>     arrow_radii1     = {};
-    vector<vec3f>     arrow_centers0   = {};
-    vector<vec3f>     arrow_centers1   = {};
-    vector<float>     line_lengths     = {};
-    vector<float>     border_lengths   = {};
+    shape_view<vec3f> positions = {};
+
+    shape_view<int>   points    = {};
+    shape_view<vec2i> lines     = {};
+    shape_view<vec3i> triangles = {};
+    shape_view<vec4i> quads     = {};
+    shape_view<vec2i> borders   = {};
+
+    shape_view<vec4f>     fills = {};
+    shape_view<line_ends> ends  = {};
+
+    // vertex radii, empty if all vertices share the same radius
+    float         radius = 0;
+    vector<float> radii  = {};
+
+    // arrow-heads, stored only for lines with arrow ends and indexed by line,
+    // with -1 for capped lines; indices are empty if there are no arrows
+    vector<int>        arrow_ids = {};
+    vector<line_arrow> arrows    = {};
+
+    // dash offsets, the screen length of the preceding lines, empty if the
+    // material is never dashed
+    vector<float> line_offsets   = {};
+    vector<float> border_offsets = {};
 
     int material = -1;
   };
 
+  // Vertex radius and line arrow-heads, zero for capped lines
+  inline float eval_radius(const trace_shape& shape, int vertex) {
+    return shape.radii.empty() ? shape.radius : shape.radii[vertex];
+  }
+  inline const line_arrow& eval_arrow(const trace_shape& shape, int line) {
+    static const auto no_arrow = line_arrow{};
+    if (shape.arrow_ids.empty() || shape.arrow_ids[line] < 0) return no_arrow;
+    return shape.arrows[shape.arrow_ids[line]];
+  }
+
   struct trace_shapes {
     vector<trace_shape> shapes = {};
   };
@@ -93,8 +150,26 @@ namespace yocto {
     }
   };
 
+  // Borders of a diagram shape, with the faces they were made from
+  struct shape_borders {
+    bool                      boundary  = false;
+    int                       vertices  = 0;
+    vector<vec3i>             triangles = {};
+    vector<vec4i>             quads     = {};
+    shared_ptr<vector<vec2i>> borders   = nullptr;
+  };
+
+  // Borders of the shapes of a scene, kept by the caller between builds of
+  // the same scene, and made again only for the shapes whose faces changed
+  struct shapes_cache {
+    vector<shape_borders> shapes = {};
+  };
+
   trace_shapes make_shapes(const dgram_scene& scene, const int& cam,
       const vec2f& size, const float& scale, const bool noparallel = false);
+  trace_shapes make_shapes(const dgram_scene& scene, shapes_cache& cache,
+      const int& cam, const vec2f& size, const float& scale,
+      const bool noparallel = false);
 
 }  // namespace yocto
 
@@ -33,22 +33,53 @@
 #include "yocto_dgram_text.h"
 
 #include <yocto/ext/stb_image.h>
+#include <yocto/ext/stb_image_write.h>
 #include <yocto/yocto_geometry.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <future>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "ext/HTTPRequest.hpp"
 #include "ext/base64.h"
+#include "ext/lm_regular.h"
 #include "yocto_dgram_geometry.h"
 
+#ifdef _WIN32
+#pragma warning(push)
+#pragma warning(disable : 4505)
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <imstb_rectpack.h>
+
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+#include <imstb_truetype.h>
+
+#ifdef _WIN32
+#pragma warning(pop)
+#else
+#pragma GCC diagnostic pop
+#endif
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
 namespace yocto {
 
   // using directives
+  using std::array;
   using std::make_pair;
   using std::pair;
   using std::to_string;
@@ -138,62 +169,114 @@ namespace yocto {
     return image;
   }
 
-  static image_data make_placeholder(
+  // Crops 8-bit pixels, placed at offset in a frame, to the non-transparent
+  // ones, premultiplying them by alpha if requested
+  static dgram_label_image crop_label_image(const vec4b* pixels,
+      const int width, const int height, const vec2i& offset,
+      const vec2i& frame, const bool premultiply = true) {
+    auto label  = dgram_label_image{};
+    label.frame = frame;
+
+    // bounds of the non-transparent pixels
+    auto min = vec2i{width, height};
+    auto max = vec2i{-1, -1};
+    for (auto j = 0; j < height; j++) {
+      for (auto i = 0; i < width; i++) {
+        if (pixels[(size_t)j * width + i].w == 0) continue;
+        min = {yocto::min(min.x, i), yocto::min(min.y, j)};
+        max = {yocto::max(max.x, i), yocto::max(max.y, j)};
+      }
+    }
+    if (max.x < 0) return label;
+
+    // one transparent pixel around the bounds is kept for bilinear filtering
+    auto start = vec2i{yocto::max(offset.x + min.x - 1, 0),
+        yocto::max(offset.y + min.y - 1, 0)};
+    auto end   = vec2i{yocto::min(offset.x + max.x + 2, frame.x),
+        yocto::min(offset.y + max.y + 2, frame.y)};
+    label.offset = start;
+    label.width  = end.x - start.x;
+    label.height = end.y - start.y;
+
+    auto cropped = vector<vec4b>((size_t)label.width * label.height);
+    for (auto j = 0; j < label.height; j++) {
+      for (auto i = 0; i < label.width; i++) {
+        auto si = start.x + i - offset.x, sj = start.y + j - offset.y;
+        if (si < 0 || sj < 0 || si >= width || sj >= height) continue;
+        auto& p = pixels[(size_t)sj * width + si];
+        cropped[(size_t)j * label.width + i] =
+            premultiply ? vec4b{(byte)((p.x * p.w + 127) / 255),
+                              (byte)((p.y * p.w + 127) / 255),
+                              (byte)((p.z * p.w + 127) / 255), p.w}
+                        : p;
+      }
+    }
+    label.pixels = std::make_shared<const vector<vec4b>>(std::move(cropped));
+
+    return label;
+  }
+
+  bool decode_label_image(
+      const vector<byte>& buffer, dgram_label_image& image) {
+    auto width = 0, height = 0, ncomp = 0;
+    auto pixels = stbi_load_from_memory(
+        buffer.data(), (int)buffer.size(), &width, &height, &ncomp, 4);
+    if (!pixels) return false;
+    image = crop_label_image(
+        (vec4b*)pixels, width, height, {0, 0}, {width, height});
+    free(pixels);
+    return true;
+  }
+
+  static dgram_label_image make_placeholder(
       const float alignment, const int width, const int height) {
-    auto image             = make_image(width * 2, height * 2, false);
+    auto frame             = vec2i{width * 2, height * 2};
     auto placeholder_image = base64_to_image(placeholder);
     placeholder_image = resize_image(placeholder_image, width * 130 / 720, 0);
 
-    auto i = (image.width - placeholder_image.width) / 2;
+    auto i = (frame.x - placeholder_image.width) / 2;
     if (alignment < 0)
       i = 0;
     else if (alignment > 0)
-      i = image.width - placeholder_image.width;
-    auto j = image.height - placeholder_image.height;
-    set_region(image, placeholder_image, i, j);
+      i = frame.x - placeholder_image.width;
+    auto j = frame.y - placeholder_image.height;
 
-    return image;
+    auto pixels = vector<vec4b>(placeholder_image.pixels.size());
+    for (auto idx = 0; idx < pixels.size(); idx++) {
+      pixels[idx] = float_to_byte(placeholder_image.pixels[idx]);
+    }
+    return crop_label_image(pixels.data(), placeholder_image.width,
+        placeholder_image.height, {i, j}, frame);
   }
 
-  static image_data make_text_image(const string& text, const float alignment,
-      const vec4f& color, const int width, const int height, const float zoom) {
-    http::Request request{"localhost:5500/rasterize"};
-    auto body = "text=" + escape_string(text) + "&width=" + to_string(width) +
-                "&height=" + to_string(height) + "&zoom=" + to_string(zoom) +
-                "&align_x=" + to_string(alignment) +
-                "&r=" + to_string((int)round(color.x * 255)) +
-                "&g=" + to_string((int)round(color.y * 255)) +
-                "&b=" + to_string((int)round(color.z * 255)) +
-                "&a=" + to_string((int)round(color.w));
-    auto response = request.send(
-        "POST", body, {"Content-Type: application/x-www-form-urlencoded"});
-    auto string64 = string{response.body.begin(), response.body.end()};
-
-    return base64_to_image(string64);
+  // Placeholders are shared by all the labels with the same size and side,
+  // so that they are built and packed in the atlases once
+  static dgram_label_image get_placeholder(
+      const float alignment, const int width, const int height) {
+    static auto mutex        = std::mutex{};
+    static auto placeholders = vector<pair<vec3i, dgram_label_image>>{};
+
+    auto side = alignment < 0 ? -1 : (alignment > 0 ? 1 : 0);
+    auto key  = vec3i{side, width, height};
+    auto lock = std::lock_guard{mutex};
+    for (auto& [key_, placeholder] : placeholders)
+      if (key_ == key) return placeholder;
+    placeholders.push_back({key, make_placeholder(alignment, width, height)});
+    return placeholders.back().second;
   }
 
-  static trace_text make_text(const int i, const int j, dgram_scene& scene,
+  static trace_text make_text(const int i, const int j,
+      const dgram_scene& scene, dgram_label_image& label_image,
       const int width, const int height, const vec2f& size, const float scale,
       const bool orthographic, const frame3f& camera_frame,
       const float camera_distance, const vec2f& film, const float lens,
-      const bool rerender) {
-    auto text = trace_text{};
-
-    auto& object   = scene.objects[i];
-    auto& label    = scene.labels[object.labels];
-    auto& material = scene.materials[object.material];
-    auto& color    = material.stroke;
-
-    if (rerender) {
-      text.image = make_text_image(label.texts[j], label.alignments[j], color,
-          width, height, width / size.x);
-      label.images[j] = text.image;
-    } else {
-      if (!label.images[j].pixels.empty() && label.images[j].width == width * 2)
-        text.image = label.images[j];
-      else
-        text.image = make_placeholder(label.alignments[j], width, height);
-    }
+      const dgram_frustum& frustum, dgram_label_image& text_image) {
+    auto text   = trace_text{};
+    text.object = i;
+    text.index  = j;
+
+    auto& object = scene.objects[i];
+    auto& label  = scene.labels[object.labels];
 
     // Computing text positions
     auto p        = transform_point(object.frame, label.positions[j]);
@@ -220,141 +303,273 @@ namespace yocto {
             : vec3f{offset.x * film.x / size.x,
                   (-baseline - offset.y) * film.x / size.x, 0};
 
-    float align_x0, align_x1, align_x2, align_x3;
-
-    if (label.alignments[j] > 0) {
-      align_x0 = im_w;
-      align_x1 = 0.0f;
-      align_x2 = 0.0f;
-      align_x3 = im_w;
-    } else if (label.alignments[j] < 0) {
-      align_x0 = 0.0f;
-      align_x1 = -im_w;
-      align_x2 = -im_w;
-      align_x3 = 0.0f;
-    } else {
-      align_x0 = im_w / 2;
-      align_x1 = -im_w / 2;
-      align_x2 = -im_w / 2;
-      align_x3 = im_w / 2;
-    }
-
-    auto align_y0 = -im_h;
-    auto align_y1 = -im_h;
-    auto align_y2 = 0.0f;
-    auto align_y3 = 0.0f;
-
-    vec3f p0, p1, p2, p3;
-
+    // label frame edges on the image plane
     auto screen_camera_p = orthographic
                                ? vec3f{camera_p.x, camera_p.y, 0}
                                : screen_space_point(camera_p, plane_distance);
     screen_camera_p += screen_off;
 
-    auto screen_camera_p0 = screen_camera_p - vec3f{align_x0, align_y0, 0};
-    auto screen_camera_p1 = screen_camera_p - vec3f{align_x1, align_y1, 0};
-    auto screen_camera_p2 = screen_camera_p - vec3f{align_x2, align_y2, 0};
-    auto screen_camera_p3 = screen_camera_p - vec3f{align_x3, align_y3, 0};
+    auto left = screen_camera_p.x - im_w / 2;
+    if (label.alignments[j] > 0)
+      left = screen_camera_p.x - im_w;
+    else if (label.alignments[j] < 0)
+      left = screen_camera_p.x;
+    auto top = screen_camera_p.y + im_h;
 
-    if (orthographic) {
-      p0 = transform_point(camera_frame,
-          vec3f{screen_camera_p0.x, screen_camera_p0.y, camera_p.z});
-      p1 = transform_point(camera_frame,
-          vec3f{screen_camera_p1.x, screen_camera_p1.y, camera_p.z});
-      p2 = transform_point(camera_frame,
-          vec3f{screen_camera_p2.x, screen_camera_p2.y, camera_p.z});
-      p3 = transform_point(camera_frame,
-          vec3f{screen_camera_p3.x, screen_camera_p3.y, camera_p.z});
-    } else {
-      p0 = transform_point(
-          camera_frame, world_space_point(screen_camera_p0, camera_p.z));
-      p1 = transform_point(
-          camera_frame, world_space_point(screen_camera_p1, camera_p.z));
-      p2 = transform_point(
-          camera_frame, world_space_point(screen_camera_p2, camera_p.z));
-      p3 = transform_point(
-          camera_frame, world_space_point(screen_camera_p3, camera_p.z));
+    // quad covering a region of the label frame, in normalized coordinates
+    auto make_quad = [&](const vec2f& uv_min, const vec2f& uv_max) {
+      auto corners = array<vec3f, 4>{};
+      auto uvs     = array<vec2f, 4>{uv_min, vec2f{uv_max.x, uv_min.y}, uv_max,
+          vec2f{uv_min.x, uv_max.y}};
+      for (auto k = 0; k < 4; k++) {
+        auto screen_camera_pk = vec3f{left + im_w * uvs[k].x,
+            top - im_h * uvs[k].y, screen_camera_p.z};
+        corners[k] = orthographic
+                         ? transform_point(camera_frame,
+                               vec3f{screen_camera_pk.x, screen_camera_pk.y,
+                                   camera_p.z})
+                         : transform_point(camera_frame,
+                               world_space_point(screen_camera_pk, camera_p.z));
+      }
+      return corners;
+    };
+    auto is_visible = [&](const array<vec3f, 4>& corners) {
+      auto bounds = invalidb3f;
+      for (auto& corner : corners)
+        bounds = merge(bounds, project_frustum(frustum, corner));
+      return overlap_window(frustum, bounds, 0);
+    };
+
+    text.name = label.names[j];
+
+    // Culling texts outside of the frustum, that are left without positions
+    if (!is_visible(make_quad({0, 0}, {1, 1}))) return text;
+
+    // plain text is rasterized in-process when its content or size change.
+    // Other images are drawn only if rasterized for this request, or for the
+    // default size if distance fields, that are missing if never loaded.
+    auto request = make_text_request(scene, i, j, size, width, height);
+    auto key     = make_text_key(request);
+    if (is_plain_text(label.texts[j]) && label_image.key != key) {
+      label_image     = make_text_image(request);
+      label_image.key = key;
     }
+    auto is_field = [&]() {
+      if (j >= object.fields.size()) return false;
+      auto& field = object.fields[j];
+      if (field.frame.x == 0) return false;
+      auto default_size = get_text_size(size);
+      return field.key == make_text_key(make_text_request(scene, i, j, size,
+                              default_size.x, default_size.y));
+    };
 
-    text.positions.push_back(p0);
-    text.positions.push_back(p1);
-    text.positions.push_back(p2);
-    text.positions.push_back(p3);
+    auto image = label_image.key == key && label_image.frame.x != 0
+                     ? label_image
+                 : is_field()
+                     ? object.fields[j]
+                     : get_placeholder(label.alignments[j], width, height);
+    if (!image.pixels) return text;
 
-    text.name = label.names[j];
+    // quad sized to the cropped image
+    auto frame   = vec2f{(float)image.frame.x, (float)image.frame.y};
+    auto offset0 = vec2f{(float)image.offset.x, (float)image.offset.y};
+    auto offset1 = offset0 + vec2f{(float)image.width, (float)image.height};
+    auto corners = make_quad(offset0 / frame, offset1 / frame);
+    if (!is_visible(corners)) return text;
+
+    text_image = image;
+    text.sdf   = image.sdf;
+    if (image.sdf) text.sdf_scale = (float)width / image.frame.x;
+    for (auto& corner : corners) text.positions.push_back(corner);
 
     return text;
   }
 
-  text_images make_text_images(const dgram_scene& scene, const vec2f& size,
-      const float& scale, const int width, const int height) {
-    auto images = text_images{};
+  // Packs the images of the texts in the pages of the atlas. Images
+  // already in the atlas keep their place, so only new ones are copied, in
+  // new pages; the atlas is packed again once mostly unused. Images shared
+  // by many texts are packed once. Each image is followed by a transparent
+  // row and column, that are read by the bilinear lookups at its borders.
+  static void make_atlas(trace_texts& texts,
+      const vector<dgram_label_image>& images, dgram_label_atlas& atlas) {
+    auto lookup = std::unordered_map<const vector<vec4b>*, int>{};
+    for (auto idx = 0; idx < atlas.images.size(); idx++)
+      lookup.insert({atlas.images[idx].get(), idx});
 
-    for (auto i = 0; i < scene.objects.size(); i++) {
-      auto& object = scene.objects[i];
-      if (object.labels != -1) {
-        auto& label    = scene.labels[object.labels];
-        auto& material = scene.materials[object.material];
-        auto& color    = material.stroke;
-        for (auto j = 0; j < label.texts.size(); j++) {
-          auto& text_image = images.images.emplace_back();
-          text_image.image = make_text_image(label.texts[j],
-              label.alignments[j], color, width, height, width / size.x);
-          text_image.name  = label.names[j];
+    // area of the atlas and of the images still used
+    auto atlas_area = (size_t)0, used_area = (size_t)0;
+    for (auto& pixels : atlas.images) atlas_area += pixels->size();
+    auto visited = std::unordered_set<const vector<vec4b>*>{};
+    for (auto& image : images) {
+      if (!visited.insert(image.pixels.get()).second) continue;
+      if (lookup.count(image.pixels.get()) != 0)
+        used_area += image.pixels->size();
+    }
+    if (atlas_area > 2 * used_area) {
+      atlas = {};
+      lookup.clear();
+    }
+
+    // new images
+    auto rects  = vector<stbrp_rect>{};
+    auto fresh  = vector<const dgram_label_image*>{};
+    auto placed = std::unordered_set<const vector<vec4b>*>{};
+    for (auto& image : images) {
+      if (lookup.count(image.pixels.get()) != 0) continue;
+      if (!placed.insert(image.pixels.get()).second) continue;
+      auto rect = stbrp_rect{};
+      rect.id   = (int)fresh.size();
+      rect.w    = (stbrp_coord)(image.width + 1);
+      rect.h    = (stbrp_coord)(image.height + 1);
+      rects.push_back(rect);
+      fresh.push_back(&image);
+    }
+
+    // copies the packed images in a new page
+    auto add_page = [&](const vector<stbrp_rect>& rects, int width) {
+      auto height = 0;
+      for (auto& rect : rects) height = max(height, rect.y + rect.h);
+      auto pixels = vector<vec4b>((size_t)width * height, {0, 0, 0, 0});
+      for (auto& rect : rects) {
+        auto& image = *fresh[rect.id];
+        for (auto j = 0; j < image.height; j++) {
+          std::copy(image.pixels->begin() + (size_t)j * image.width,
+              image.pixels->begin() + (size_t)(j + 1) * image.width,
+              pixels.begin() + (size_t)(rect.y + j) * width + rect.x);
         }
+        lookup.insert({image.pixels.get(), (int)atlas.images.size()});
+        atlas.images.push_back(image.pixels);
+        atlas.placements.push_back(
+            {(int)atlas.pages.size(), rect.x, rect.y});
+      }
+      atlas.pages.push_back({width, height,
+          std::make_shared<const vector<vec4b>>(std::move(pixels))});
+    };
+
+    // images larger than a page are stored in a page of their own
+    const auto max_size = 1 << 15;
+    auto       fitting  = vector<stbrp_rect>{};
+    for (auto& rect : rects) {
+      if (rect.w <= max_size && rect.h <= max_size) {
+        fitting.push_back(rect);
+      } else {
+        rect.x = 0;
+        rect.y = 0;
+        add_page({rect}, rect.w);
+      }
+    }
+
+    // pages start square, and are widened until all the images fit; images
+    // left out of the largest page are packed in the next ones
+    rects = std::move(fitting);
+    while (!rects.empty()) {
+      auto area = (size_t)0, width = (size_t)1;
+      for (auto& rect : rects) {
+        area += (size_t)rect.w * rect.h;
+        width = max(width, (size_t)rect.w);
       }
+      width = min(max(width, (size_t)sqrt((double)area)), (size_t)max_size);
+      while (true) {
+        auto context = stbrp_context{};
+        auto nodes   = vector<stbrp_node>(width);
+        stbrp_init_target(
+            &context, (int)width, max_size, nodes.data(), (int)width);
+        if (stbrp_pack_rects(&context, rects.data(), (int)rects.size())) break;
+        if (width >= max_size) break;
+        width = min(width * 2, (size_t)max_size);
+      }
+      auto packed = vector<stbrp_rect>{}, left = vector<stbrp_rect>{};
+      for (auto& rect : rects)
+        (rect.was_packed ? packed : left).push_back(rect);
+      add_page(packed, (int)width);
+      rects = std::move(left);
     }
 
-    return images;
+    texts.pages = atlas.pages;
+    for (auto idx = 0; idx < images.size(); idx++) {
+      auto& image     = images[idx];
+      auto& placement = atlas.placements[lookup.at(image.pixels.get())];
+      auto& text      = texts.texts[idx];
+      text.page       = placement.x;
+      text.min        = {placement.y, placement.z};
+      text.size       = {image.width, image.height};
+    }
   }
 
-  trace_texts make_texts(dgram_scene& scene, const int& cam, const vec2f& size,
-      const float& scale, const int width, const int height,
-      const bool noparallel, const bool rerender) {
+  void update_texts_cache(const dgram_scene& scene, texts_cache& cache) {
+    cache.images.resize(scene.objects.size());
+    for (auto i = 0; i < scene.objects.size(); i++) {
+      auto& object = scene.objects[i];
+      auto  count  = object.labels >= 0 && object.labels < scene.labels.size()
+                         ? scene.labels[object.labels].texts.size()
+                         : (size_t)0;
+      cache.images[i].resize(count);
+    }
+  }
+
+  trace_texts make_texts(const dgram_scene& scene, const int& cam,
+      const vec2f& size, const float& scale, const int width,
+      const int height, const bool noparallel) {
+    auto cache = texts_cache{};
+    return make_texts(
+        scene, cache, cam, size, scale, width, height, noparallel);
+  }
+
+  trace_texts make_texts(const dgram_scene& scene, texts_cache& cache,
+      const int& cam, const vec2f& size, const float& scale, const int width,
+      const int height, const bool noparallel) {
     auto& camera          = scene.cameras[cam];
     auto  camera_frame    = lookat_frame(camera.from, camera.to, {0, 1, 0});
     auto  camera_distance = length(camera.from - camera.to);
     auto  aspect          = size.x / size.y;
     auto  film = aspect >= 1 ? vec2f{camera.film, camera.film / aspect}
                              : vec2f{camera.film * aspect, camera.film};
+    auto  frustum = make_frustum(camera, scene.offset, size, scale);
 
-    auto texts = trace_texts{};
-
-    if (noparallel) {
-      for (auto i = 0; i < scene.objects.size(); i++) {
-        auto& object = scene.objects[i];
-        if (object.labels != -1) {
-          auto& label = scene.labels[object.labels];
-          for (auto j = 0; j < label.texts.size(); j++) {
-            auto text = make_text(i, j, scene, width, height, size, scale,
-                camera.orthographic, camera_frame, camera_distance, film,
-                camera.lens, rerender);
-            texts.texts.push_back(text);
-          }
+    // each text writes only its own bitmap in the cache, so they are built
+    // in parallel
+    update_texts_cache(scene, cache);
+    auto idxs = vector<pair<int, int>>{};
+    for (auto i = 0; i < scene.objects.size(); i++) {
+      auto& object = scene.objects[i];
+      if (object.labels != -1) {
+        auto& label = scene.labels[object.labels];
+        for (auto j = 0; j < label.texts.size(); j++) {
+          idxs.push_back(make_pair(i, j));
         }
       }
+    }
+
+    auto texts  = trace_texts{};
+    auto images = vector<dgram_label_image>(idxs.size());
+    texts.texts.resize(idxs.size());
+    auto make = [&](size_t idx) {
+      auto i           = idxs[idx].first;
+      auto j           = idxs[idx].second;
+      texts.texts[idx] = make_text(i, j, scene, cache.images[i][j], width,
+          height, size, scale, camera.orthographic, camera_frame,
+          camera_distance, film, camera.lens, frustum, images[idx]);
+    };
+    if (noparallel) {
+      for (auto idx = (size_t)0; idx < idxs.size(); idx++) make(idx);
     } else {
-      auto idxs = vector<pair<int, int>>{};
-      for (auto i = 0; i < scene.objects.size(); i++) {
-        auto& object = scene.objects[i];
-        if (object.labels != -1) {
-          auto& label = scene.labels[object.labels];
-          for (auto j = 0; j < label.texts.size(); j++) {
-            idxs.push_back(make_pair(i, j));
-          }
-        }
-      }
+      parallel_for(idxs.size(), make);
+    }
 
-      texts.texts.resize(idxs.size());
-      parallel_for(idxs.size(), [&](size_t idx) {
-        auto i           = idxs[idx].first;
-        auto j           = idxs[idx].second;
-        auto text        = make_text(i, j, scene, width, height, size, scale,
-                   camera.orthographic, camera_frame, camera_distance, film,
-                   camera.lens, rerender);
-        texts.texts[idx] = text;
-      });
+    // removing culled texts
+    auto count = (size_t)0;
+    for (auto idx = (size_t)0; idx < idxs.size(); idx++) {
+      if (texts.texts[idx].positions.empty()) continue;
+      if (count != idx) {
+        texts.texts[count] = std::move(texts.texts[idx]);
+        images[count]      = std::move(images[idx]);
+      }
+      count++;
     }
+    texts.texts.resize(count);
+    images.resize(count);
+
+    make_atlas(texts, images, cache.atlas);
 
     return texts;
   }
@@ -367,13 +582,503 @@ namespace yocto {
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// TEXT DISTANCE FIELDS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Distances are stored in texels, up to the spread on both sides of the
+  // edges, with the edges at the middle of the alpha range
+  static const auto label_sdf_spread = 4.0f;
+
+  // Squared distance transform of a sampled function along a line, from
+  // Felzenszwalb and Huttenlocher. Buffers have space for n + 1 elements.
+  static void distance_transform(const float* f, float* d, const int n,
+      const int stride, int* v, float* z) {
+    auto parabola = [&](int q, int p) {
+      return ((f[q * stride] + q * q) - (f[p * stride] + p * p)) /
+             (2 * q - 2 * p);
+    };
+    auto k = 0;
+    v[0]   = 0;
+    z[0]   = -flt_max;
+    z[1]   = flt_max;
+    for (auto q = 1; q < n; q++) {
+      auto s = parabola(q, v[k]);
+      while (s <= z[k]) s = parabola(q, v[--k]);
+      k++;
+      v[k]     = q;
+      z[k]     = s;
+      z[k + 1] = flt_max;
+    }
+    k = 0;
+    for (auto q = 0; q < n; q++) {
+      while (z[k + 1] < q) k++;
+      d[q] = (float)((q - v[k]) * (q - v[k])) + f[v[k] * stride];
+    }
+  }
+
+  // Euclidean distance of each pixel to the closest one in the mask
+  static vector<float> distance_transform(
+      const vector<bool>& mask, const int width, const int height) {
+    auto grid = vector<float>((size_t)width * height);
+    for (auto idx = 0; idx < (int)grid.size(); idx++)
+      grid[idx] = mask[idx] ? 0 : 1e20f;
+    auto size = std::max(width, height);
+    auto d    = vector<float>(size);
+    auto v    = vector<int>(size + 1);
+    auto z    = vector<float>(size + 1);
+    for (auto i = 0; i < width; i++) {
+      distance_transform(
+          &grid[i], d.data(), height, width, v.data(), z.data());
+      for (auto j = 0; j < height; j++) grid[(size_t)j * width + i] = d[j];
+    }
+    for (auto j = 0; j < height; j++) {
+      auto row = &grid[(size_t)j * width];
+      distance_transform(row, d.data(), width, 1, v.data(), z.data());
+      for (auto i = 0; i < width; i++) row[i] = sqrt(d[i]);
+    }
+    return grid;
+  }
+
+  bool make_label_sdf(
+      const vector<byte>& png, vector<byte>& sdf, string& error) {
+    auto width = 0, height = 0, ncomp = 0;
+    auto data = stbi_load_from_memory(
+        png.data(), (int)png.size(), &width, &height, &ncomp, 4);
+    if (!data) {
+      error = "cannot decode label image";
+      return false;
+    }
+    auto pixels = vector<vec4b>((vec4b*)data, (vec4b*)data + width * height);
+    free(data);
+
+    // text color, kept by the texels outside of the text, and bounds of the
+    // pixels inside the text
+    auto color = vec4b{0, 0, 0, 0};
+    auto min = vec2i{width, height}, max = vec2i{-1, -1};
+    for (auto j = 0; j < height; j++) {
+      for (auto i = 0; i < width; i++) {
+        auto& p = pixels[(size_t)j * width + i];
+        if (p.w > color.w) color = p;
+        if (p.w < 128) continue;
+        min = {std::min(min.x, i), std::min(min.y, j)};
+        max = {std::max(max.x, i), std::max(max.y, j)};
+      }
+    }
+
+    // distances are computed on the pixels within the spread of the text,
+    // with a texel per pixel. Pixels on the edges take their distance from
+    // their coverage, that is exact for straight edges, and the others from
+    // the closest pixel across the edges. Covered texels keep their color.
+    auto result = vector<vec4b>(
+        (size_t)width * height, {color.x, color.y, color.z, 0});
+    if (max.x >= 0) {
+      auto margin  = (int)label_sdf_spread + 2;
+      auto start   = vec2i{std::max(min.x - margin, 0),
+          std::max(min.y - margin, 0)};
+      auto end     = vec2i{std::min(max.x + margin + 1, width),
+          std::min(max.y + margin + 1, height)};
+      auto region  = end - start;
+      auto inside  = vector<bool>((size_t)region.x * region.y);
+      auto outside = vector<bool>(inside.size());
+      for (auto j = 0; j < region.y; j++) {
+        for (auto i = 0; i < region.x; i++) {
+          auto alpha = pixels[(size_t)(start.y + j) * width + start.x + i].w;
+          inside[(size_t)j * region.x + i]  = alpha >= 128;
+          outside[(size_t)j * region.x + i] = alpha < 128;
+        }
+      }
+      // distances from pixel centers, with the edges half a pixel away
+      auto to_inside  = distance_transform(inside, region.x, region.y);
+      auto to_outside = distance_transform(outside, region.x, region.y);
+      for (auto j = 0; j < region.y; j++) {
+        for (auto i = 0; i < region.x; i++) {
+          auto  idx      = (size_t)j * region.x + i;
+          auto  pixel    = (size_t)(start.y + j) * width + start.x + i;
+          auto& p        = pixels[pixel];
+          auto  distance = inside[idx] ? to_outside[idx] - 0.5f
+                                       : 0.5f - to_inside[idx];
+          if (p.w > 0 && p.w < 255) distance = p.w / 255.0f - 0.5f;
+          auto value = clamp(
+              (distance / label_sdf_spread + 1) / 2 * 255, 0.0f, 255.0f);
+          if (p.w > 0) result[pixel] = {p.x, p.y, p.z, 0};
+          result[pixel].w = (byte)round(value);
+        }
+      }
+    }
+
+    sdf.clear();
+    auto write = [](void* context, void* data, int size) {
+      auto& buffer = *(vector<byte>*)context;
+      buffer.insert(buffer.end(), (byte*)data, (byte*)data + size);
+    };
+    if (!stbi_write_png_to_func(
+            write, &sdf, width, height, 4, result.data(), width * 4)) {
+      error = "cannot encode label distance field";
+      return false;
+    }
+    return true;
+  }
+
+  bool load_label_sdf(
+      const string& filename, dgram_label_image& image, string& error) {
+    auto width = 0, height = 0, ncomp = 0;
+    auto pixels = stbi_load(filename.c_str(), &width, &height, &ncomp, 4);
+    if (!pixels) {
+      error = "cannot load " + filename;
+      return false;
+    }
+    image = crop_label_image(
+        (vec4b*)pixels, width, height, {0, 0}, {width, height}, false);
+    image.sdf = true;
+    free(pixels);
+    return true;
+  }
+
+  bool get_label_size(const string& filename, vec2i& size) {
+    auto ncomp = 0;
+    return stbi_info(filename.c_str(), &size.x, &size.y, &ncomp) != 0;
+  }
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// TEXT SERVER
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  static const auto text_server_url = "localhost:5500/rasterize";
+
+  // Body of a rasterization request, that also identifies the image
+  static string make_text_body(const text_request& request) {
+    auto& color = request.color;
+    return "text=" + escape_string(request.text) +
+           "&width=" + to_string(request.width) +
+           "&height=" + to_string(request.height) +
+           "&zoom=" + to_string(request.zoom) +
+           "&align_x=" + to_string(request.alignment) +
+           "&r=" + to_string((int)round(color.x * 255)) +
+           "&g=" + to_string((int)round(color.y * 255)) +
+           "&b=" + to_string((int)round(color.z * 255)) +
+           "&a=" + to_string((int)round(color.w));
+  }
+
+  vec2i get_text_size(const vec2f& size, int resolution) {
+    auto aspect = size.x / size.y;
+    auto res    = resolution != 0 ? resolution : 2 * (int)round(size.x);
+    return {res, (int)round(res / aspect)};
+  }
+
+  text_request make_text_request(const dgram_scene& scene, int object,
+      int index, const vec2f& size, int width, int height) {
+    auto& label    = scene.labels[scene.objects[object].labels];
+    auto& material = scene.materials[scene.objects[object].material];
+    return {label.texts[index], label.alignments[index], material.stroke,
+        width, height, width / size.x};
+  }
+
+  string make_text_key(const text_request& request) {
+    // 64-bit FNV-1a of the request body
+    auto body = make_text_body(request);
+    auto hash = (uint64_t)14695981039346656037ull;
+    for (auto c : body) {
+      hash ^= (uint8_t)c;
+      hash *= (uint64_t)1099511628211ull;
+    }
+    auto stream = std::ostringstream{};
+    stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return stream.str();
+  }
+
+  // Sends a request over a connection, retrying transport and server
+  // failures. Rejected requests and responses that are not PNG images fail
+  // immediately, since they would fail again.
+  static bool send_text_request(http::Request& connection,
+      const text_request& request, vector<byte>& png,
+      const text_client_params& params, string& error) {
+    auto body    = make_text_body(request);
+    auto timeout = std::chrono::milliseconds{
+        params.timeout > 0 ? params.timeout : -1};
+    auto reason  = string{};
+    for (auto attempt = 0; attempt <= params.retries; attempt++) {
+      try {
+        auto response = connection.send("POST", body,
+            {"Content-Type: application/x-www-form-urlencoded"}, timeout);
+        if (response.status != 200) {
+          reason = "status " + to_string(response.status);
+          if (response.status >= 400 && response.status < 500) break;
+          continue;
+        }
+        png = base64_decode(
+            string{response.body.begin(), response.body.end()});
+        auto width = 0, height = 0, ncomp = 0;
+        if (!stbi_info_from_memory(
+                png.data(), (int)png.size(), &width, &height, &ncomp)) {
+          reason = "invalid image";
+          break;
+        }
+        return true;
+      } catch (const std::exception& exception) {
+        reason = exception.what();
+      }
+    }
+    error = "cannot rasterize label " + request.text + " (" + reason + ")";
+    return false;
+  }
+
+  bool make_text_png(const text_request& request, vector<byte>& png,
+      const text_client_params& params, string& error) {
+    auto connection = http::Request{text_server_url};
+    return send_text_request(connection, request, png, params, error);
+  }
+
+  bool make_text_pngs(const vector<text_request>& requests,
+      const function<bool(int, const vector<byte>&, string&)>& func,
+      const text_client_params& params, string& error) {
+    if (requests.empty()) return true;
+
+    // each worker owns a connection and takes the next request when done
+    auto              nworkers = clamp(
+        params.concurrency, 1, (int)requests.size());
+    auto              futures  = vector<std::future<void>>{};
+    auto              errors   = vector<string>(nworkers);
+    std::atomic<int>  next_idx(0);
+    std::atomic<bool> has_error(false);
+    for (auto worker = 0; worker < nworkers; worker++) {
+      futures.emplace_back(std::async(std::launch::async, [&, worker]() {
+        auto connection = http::Request{text_server_url};
+        auto png        = vector<byte>{};
+        while (!has_error) {
+          auto idx = next_idx.fetch_add(1);
+          if (idx >= (int)requests.size()) break;
+          if (!send_text_request(
+                  connection, requests[idx], png, params, errors[worker]) ||
+              !func(idx, png, errors[worker])) {
+            has_error = true;
+            break;
+          }
+        }
+      }));
+    }
+    for (auto& future : futures) future.get();
+
+    for (auto& worker_error : errors) {
+      if (worker_error.empty()) continue;
+      error = worker_error;
+      return false;
+    }
+    return true;
+  }
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// TEXT RASTERIZATION
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  bool is_plain_text(const string& text) {
+    // math delimiters, the server markup for bold, italic, subscripts and
+    // superscripts, and html
+    for (auto c : text) {
+      if (c == '$' || c == '\\' || c == '*' || c == '_' || c == '~' ||
+          c == '^' || c == '<' || c == '>' || c == '&')
+        return false;
+    }
+    return true;
+  }
+
+  // Font loaded once from the embedded data
+  static const stbtt_fontinfo* get_text_font() {
+    static auto data = vector<unsigned char>{};
+    static auto font = stbtt_fontinfo{};
+    static auto init = [] {
+      auto size   = 0;
+      auto buffer = stbi_zlib_decode_malloc((const char*)lm_regular_ttf_zlib,
+          (int)sizeof(lm_regular_ttf_zlib), &size);
+      if (!buffer) return false;
+      data.assign(buffer, buffer + size);
+      free(buffer);
+      return (bool)stbtt_InitFont(&font, data.data(), 0);
+    }();
+    return init ? &font : nullptr;
+  }
+
+  // Decodes utf8 text to code points, collapsing white space as html does
+  static vector<int> get_text_codepoints(const string& text) {
+    auto codepoints = vector<int>{};
+    auto space      = false;
+    for (auto idx = 0; idx < (int)text.size();) {
+      auto c         = (unsigned char)text[idx];
+      auto length    = c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+      auto codepoint = length == 1   ? (int)c
+                       : length == 2 ? (int)(c & 0x1f)
+                       : length == 3 ? (int)(c & 0x0f)
+                                     : (int)(c & 0x07);
+      for (auto k = 1; k < length && idx + k < (int)text.size(); k++)
+        codepoint = (codepoint << 6) | (text[idx + k] & 0x3f);
+      idx += length;
+      if (codepoint == ' ' || codepoint == '\t' || codepoint == '\n' ||
+          codepoint == '\r') {
+        space = !codepoints.empty();
+        continue;
+      }
+      if (space) codepoints.push_back(' ');
+      codepoints.push_back(codepoint);
+      space = false;
+    }
+    return codepoints;
+  }
+
+  dgram_label_image make_text_image(const text_request& request) {
+    auto font = get_text_font();
+    if (!font) return {};
+
+    auto codepoints = get_text_codepoints(request.text);
+    auto glyphs     = vector<int>(codepoints.size());
+    for (auto idx = 0; idx < (int)codepoints.size(); idx++) {
+      glyphs[idx] = stbtt_FindGlyphIndex(font, codepoints[idx]);
+    }
+
+    // the server sets a 20pt font with a line height of 1.8, in a box at the
+    // bottom of the frame, with the page zoomed
+    auto frame     = vec2i{request.width * 2, request.height * 2};
+    auto font_size = 20 * 4 / 3.0f * request.zoom;
+    auto scale     = stbtt_ScaleForMappingEmToPixels(font, font_size);
+    auto ascent = 0, descent = 0, line_gap = 0;
+    stbtt_GetFontVMetrics(font, &ascent, &descent, &line_gap);
+    auto leading  = (1.8f * font_size - (ascent - descent) * scale) / 2;
+    auto baseline = frame.y - leading + descent * scale;
+
+    // glyph positions along the baseline
+    auto positions = vector<float>(glyphs.size());
+    auto advance   = 0.0f;
+    for (auto idx = 0; idx < (int)glyphs.size(); idx++) {
+      auto glyph_advance = 0, bearing = 0;
+      stbtt_GetGlyphHMetrics(font, glyphs[idx], &glyph_advance, &bearing);
+      positions[idx] = advance;
+      advance += glyph_advance * scale;
+      if (idx + 1 < (int)glyphs.size())
+        advance += stbtt_GetGlyphKernAdvance(
+                       font, glyphs[idx], glyphs[idx + 1]) *
+                   scale;
+    }
+    if (advance > frame.x) return {};
+
+    // the server aligns on the integer part of the alignment
+    auto alignment = (int)request.alignment;
+    auto left      = alignment < 0   ? 0.0f
+                     : alignment > 0 ? frame.x - advance
+                                     : (frame.x - advance) / 2;
+
+    // bounds of the glyph boxes, in frame pixels
+    auto boxes = vector<vec4i>(glyphs.size());
+    auto shift = vec2f{0, baseline - floor(baseline)};
+    auto min   = frame, max = vec2i{0, 0};
+    for (auto idx = 0; idx < (int)glyphs.size(); idx++) {
+      auto x   = left + positions[idx];
+      auto box = vec4i{};
+      stbtt_GetGlyphBitmapBoxSubpixel(font, glyphs[idx], scale, scale,
+          x - floor(x), shift.y, &box.x, &box.y, &box.z, &box.w);
+      box += vec4i{(int)floor(x), (int)floor(baseline), (int)floor(x),
+          (int)floor(baseline)};
+      boxes[idx] = box;
+      if (box.x >= box.z || box.y >= box.w) continue;
+      min = {std::min(min.x, box.x), std::min(min.y, box.y)};
+      max = {std::max(max.x, box.z), std::max(max.y, box.w)};
+    }
+    min = {std::max(min.x, 0), std::max(min.y, 0)};
+    max = {std::min(max.x, frame.x), std::min(max.y, frame.y)};
+    if (min.x >= max.x || min.y >= max.y) {
+      auto image  = dgram_label_image{};
+      image.frame = frame;
+      return image;
+    }
+
+    // glyph coverage, accumulated over the bounds
+    auto size     = max - min;
+    auto coverage = vector<unsigned char>((size_t)size.x * size.y, 0);
+    auto bitmap   = vector<unsigned char>{};
+    for (auto idx = 0; idx < (int)glyphs.size(); idx++) {
+      auto& box = boxes[idx];
+      if (box.x >= box.z || box.y >= box.w) continue;
+      auto x = left + positions[idx];
+      auto w = box.z - box.x, h = box.w - box.y;
+      bitmap.assign((size_t)w * h, 0);
+      stbtt_MakeGlyphBitmapSubpixel(font, bitmap.data(), w, h, w, scale,
+          scale, x - floor(x), shift.y, glyphs[idx]);
+      for (auto j = 0; j < h; j++) {
+        auto py = box.y + j - min.y;
+        if (py < 0 || py >= size.y) continue;
+        for (auto i = 0; i < w; i++) {
+          auto px = box.x + i - min.x;
+          if (px < 0 || px >= size.x) continue;
+          auto& value = coverage[(size_t)py * size.x + px];
+          value = (unsigned char)std::min(255, value + bitmap[j * w + i]);
+        }
+      }
+    }
+
+    // text color, with the alpha sent to the server
+    auto& color  = request.color;
+    auto  alpha  = clamp(round(color.w), 0.0f, 1.0f);
+    auto  pixel  = vec4b{(byte)clamp(round(color.x * 255), 0.0f, 255.0f),
+        (byte)clamp(round(color.y * 255), 0.0f, 255.0f),
+        (byte)clamp(round(color.z * 255), 0.0f, 255.0f), 0};
+    auto  pixels = vector<vec4b>(coverage.size(), pixel);
+    for (auto idx = 0; idx < (int)coverage.size(); idx++) {
+      pixels[idx].w = (byte)round(coverage[idx] * alpha);
+    }
+    return crop_label_image(pixels.data(), size.x, size.y, min, frame);
+  }
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // TEXT PROPERTIES EVALUATION
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  vec4f eval_text(const trace_text& text, const vec2f& uv) {
-    return eval_image(text.image, uv, false);
+  // Bilinear lookup of the premultiplied pixels, that treats pixels outside
+  // the image as transparent, instead of wrapping around, since images are
+  // cropped to the text
+  vec4f eval_text(
+      const trace_texts& texts, const trace_text& text, const vec2f& uv) {
+    if (text.size.x == 0 || text.size.y == 0) return {0, 0, 0, 0};
+    auto& page  = texts.pages[text.page];
+    auto& atlas = *page.pixels;
+
+    auto s = clamp(uv.x, 0.0f, 1.0f) * text.size.x;
+    auto t = clamp(uv.y, 0.0f, 1.0f) * text.size.y;
+    auto i = clamp((int)s, 0, text.size.x - 1);
+    auto j = clamp((int)t, 0, text.size.y - 1);
+    auto u = s - i, v = t - j;
+
+    // the border of the image is transparent in the atlas
+    auto color  = vec4f{0, 0, 0, 0};
+    auto lookup = [&](int i, int j, float weight) {
+      auto& p = atlas[(size_t)(text.min.y + j) * page.width +
+                      text.min.x + i];
+      color += vec4f{(float)p.x, (float)p.y, (float)p.z, (float)p.w} * weight;
+    };
+    lookup(i, j, (1 - u) * (1 - v));
+    lookup(i, j + 1, (1 - u) * v);
+    lookup(i + 1, j, u * (1 - v));
+    lookup(i + 1, j + 1, u * v);
+
+    if (text.sdf) {
+      // coverage ramps over one output pixel across the edge
+      auto& p = atlas[(size_t)(text.min.y + j) * page.width +
+                      text.min.x + i];
+      auto  distance = (color.w / 255 * 2 - 1) * label_sdf_spread;
+      auto  alpha    = clamp(0.5f + distance * text.sdf_scale, 0.0f, 1.0f);
+      return {p.x / 255.0f, p.y / 255.0f, p.z / 255.0f, alpha};
+    }
+
+    if (color.w == 0) return {0, 0, 0, 0};
+    return {color.x / color.w, color.y / color.w, color.z / color.w,
+        color.w / 255};
   }
 
 }  // namespace yocto
\ No newline at end of file
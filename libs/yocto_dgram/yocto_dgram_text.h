@@ -33,6 +33,8 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <functional>
+
 #include "yocto_dgram.h"
 
 // -----------------------------------------------------------------------------
@@ -41,6 +43,7 @@
 namespace yocto {
 
   // using directives
+  using std::function;
 
 }  // namespace yocto
 
@@ -49,35 +52,143 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+  // Page of packed label images. Pages are not written once built, so they
+  // are shared by all the texts built from them.
+  struct dgram_atlas_page {
+    int                             width  = 0;
+    int                             height = 0;
+    shared_ptr<const vector<vec4b>> pixels = nullptr;
+  };
+
+  // Label images of a scene packed in pages, kept between the builds of its
+  // texts so that only new images are packed. Images are identified by their
+  // pixels, that are kept alive by the atlas.
+  struct dgram_label_atlas {
+    vector<dgram_atlas_page>                pages      = {};
+    vector<shared_ptr<const vector<vec4b>>> images     = {};
+    vector<vec3i>                           placements = {};  // page, x, y
+  };
+
+  // Label quad, textured by a rectangle of an atlas page
   struct trace_text {
     string        name      = {};
+    int           object    = -1;
+    int           index     = -1;  // label in the object labels
     vector<vec3f> positions = {};
-    image_data    image     = {};
+    int           page      = 0;
+    vec2i         min       = {0, 0};
+    vec2i         size      = {0, 0};
+    bool          sdf       = false;
+    float         sdf_scale = 0;  // output pixels per distance texel
   };
 
+  // Label images of a scene are packed in the pages of an atlas
   struct trace_texts {
-    vector<trace_text> texts = {};
+    vector<trace_text>       texts = {};
+    vector<dgram_atlas_page> pages = {};
   };
 
-  struct text_image {
-    string     name  = {};
-    image_data image = {};
+  string escape_string(const string& value);
+
+  // Decodes a label image, cropped to its visible pixels
+  bool decode_label_image(const vector<byte>& png, dgram_label_image& image);
+
+  // Converts a label image from the text server to a distance field, at its
+  // resolution, and loads it back. Fields are stored as PNG and drawn at any
+  // size, matching the server image at its own.
+  bool make_label_sdf(
+      const vector<byte>& png, vector<byte>& sdf, string& error);
+  bool load_label_sdf(
+      const string& filename, dgram_label_image& image, string& error);
+
+  // Size of a stored label image, read from its header
+  bool get_label_size(const string& filename, vec2i& size);
+
+  // Label images of a scene kept by the caller between builds of its texts:
+  // the bitmaps rasterized for a size, by object and text, by the viewer and
+  // for plain text, and the atlas the images are packed in
+  struct texts_cache {
+    vector<vector<dgram_label_image>> images = {};
+    dgram_label_atlas                 atlas  = {};
+  };
+
+  // Sizes the bitmaps of the cache to the texts of the scene labels, keeping
+  // the bitmaps it already has
+  void update_texts_cache(const dgram_scene& scene, texts_cache& cache);
+
+  // Builds the label quads of a scene. Label images are packed in the atlas
+  // of the cache, that is reused while its images do not change.
+  trace_texts make_texts(const dgram_scene& scene, const int& cam,
+      const vec2f& size, const float& scale, const int width,
+      const int height, const bool noparallel = false);
+  trace_texts make_texts(const dgram_scene& scene, texts_cache& cache,
+      const int& cam, const vec2f& size, const float& scale, const int width,
+      const int height, const bool noparallel = false);
+
+  bool intersect_text(const trace_text& text, const ray3f& ray, vec2f& uv);
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// TEXT SERVER
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Label rasterization request
+  struct text_request {
+    string text      = "";
+    float  alignment = 0;
+    vec4f  color     = {0, 0, 0, 1};
+    int    width     = 0;
+    int    height    = 0;
+    float  zoom      = 1;
   };
 
-  struct text_images {
-    vector<text_image> images = {};
+  // Size of the label images at a resolution, by default the one of the
+  // renderer, twice the diagram width. Cached labels are keyed by their
+  // request at the default resolution, whatever the one they are made at.
+  vec2i get_text_size(const vec2f& size, int resolution = 0);
+
+  // Rasterization request of a label text of an object, at an image size
+  text_request make_text_request(const dgram_scene& scene, int object,
+      int index, const vec2f& size, int width, int height);
+
+  // Text server client options
+  struct text_client_params {
+    int concurrency = 8;      // connections to the server
+    int timeout     = 30000;  // per request, in milliseconds
+    int retries     = 2;      // attempts after a failed request
   };
 
-  string escape_string(const string& value);
+  // Key of a label image, hashed from its rasterization request. Equal keys
+  // name equal images, so they can be cached across scenes and diagrams.
+  string make_text_key(const text_request& request);
 
-  text_images make_text_images(const dgram_scene& scene, const vec2f& size,
-      const float& scale, const int width, const int height);
+  // Rasterizes a label with the text server, returning the PNG data
+  bool make_text_png(const text_request& request, vector<byte>& png,
+      const text_client_params& params, string& error);
 
-  trace_texts make_texts(dgram_scene& scene, const int& cam, const vec2f& size,
-      const float& scale, const int width, const int height,
-      const bool noparallel = false, const bool rerender = false);
+  // Rasterizes many labels over a pool of kept-alive connections. Each image
+  // is checked and passed to `func(idx, png, error)` by the connection that
+  // received it, so handling it overlaps with the other requests. Stops at
+  // the first error.
+  bool make_text_pngs(const vector<text_request>& requests,
+      const function<bool(int, const vector<byte>&, string&)>& func,
+      const text_client_params& params, string& error);
 
-  bool intersect_text(const trace_text& text, const ray3f& ray, vec2f& uv);
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// TEXT RASTERIZATION
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Whether a label has no markup or math, so it can be rasterized in-process
+  bool is_plain_text(const string& text);
+
+  // Rasterizes a plain text label with the font of the text server, laid out
+  // as the server would. Returns an empty image if the text does not fit.
+  dgram_label_image make_text_image(const text_request& request);
 
 }  // namespace yocto
 
@@ -86,7 +197,8 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  vec4f eval_text(const trace_text& text, const vec2f& uv);
+  vec4f eval_text(
+      const trace_texts& texts, const trace_text& text, const vec2f& uv);
 
 }  // namespace yocto
 
@@ -137,7 +137,7 @@ namespace yocto {
     for (auto& text : texts.texts) {
       auto uv = zero2f;
       if (intersect_text(text, ray, uv))
-        text_color = composite(eval_text(text, uv), text_color);
+        text_color = composite(eval_text(texts, text, uv), text_color);
     }
     return text_color;
   }
@@ -297,6 +297,61 @@ namespace yocto {
     state.samples += 1;
   }
 
+  void retrace_texts(dgram_trace_state& state, const dgram_scene& scene,
+      const trace_shapes& shapes, const trace_texts& texts,
+      const dgram_scene_bvh& bvh, const trace_texts& regions,
+      const dgram_trace_params& params) {
+    if (regions.texts.empty() || state.samples == 0) return;
+    auto& camera = scene.cameras[params.camera];
+
+    // pixels whose center sees one of the regions, grown by a pixel to cover
+    // the samples away from the center
+    auto offset = scene.offset * params.scale * params.width * 2 /
+                  params.size.x;
+    auto hits   = vector<bool>(state.width * state.height, false);
+    for (auto j = 0; j < state.height; j++) {
+      for (auto i = 0; i < state.width; i++) {
+        auto ray = sample_camera(camera,
+            {i - (int)offset.x, j - (int)offset.y}, {state.width, state.height},
+            {0.5f, 0.5f}, params);
+        for (auto& region : regions.texts) {
+          auto uv = zero2f;
+          if (!intersect_text(region, ray, uv)) continue;
+          hits[state.width * j + i] = true;
+          break;
+        }
+      }
+    }
+    auto mask = vector<bool>(state.width * state.height, false);
+    for (auto j = 0; j < state.height; j++) {
+      for (auto i = 0; i < state.width; i++) {
+        if (!hits[state.width * j + i]) continue;
+        for (auto jj = max(j - 1, 0); jj <= min(j + 1, state.height - 1); jj++)
+          for (auto ii = max(i - 1, 0); ii <= min(i + 1, state.width - 1); ii++)
+            mask[state.width * jj + ii] = true;
+      }
+    }
+
+    // accumulate again the samples of the masked pixels
+    auto samples = state.samples;
+    for (auto idx = 0; idx < mask.size(); idx++) {
+      if (mask[idx]) state.image[idx] = {0, 0, 0, 0};
+    }
+    for (state.samples = 0; state.samples < samples; state.samples++) {
+      auto trace = [&](int i, int j) {
+        if (!mask[state.width * j + i]) return;
+        trace_sample(state, scene, shapes, texts, bvh, i, j, params);
+      };
+      if (params.noparallel) {
+        for (auto j = 0; j < state.height; j++) {
+          for (auto i = 0; i < state.width; i++) trace(i, j);
+        }
+      } else {
+        parallel_for(state.width, state.height, trace);
+      }
+    }
+  }
+
   static void check_image(
       const image_data& image, int width, int height, bool linear) {
     if (image.width != width || image.height != height)
@@ -319,4 +374,75 @@ namespace yocto {
     }
   }
 
+  void composite_render(
+      image_data& image, const dgram_trace_state& state, bool noparallel) {
+    check_image(image, state.width, state.height, false);
+    auto scale   = 1.0f / (float)state.samples;
+    auto resolve = [&](int i, int j) {
+      auto idx          = j * state.width + i;
+      image.pixels[idx] = composite(
+          state.image[idx] * scale, image.pixels[idx]);
+    };
+    if (noparallel) {
+      for (auto j = 0; j < state.height; j++)
+        for (auto i = 0; i < state.width; i++) resolve(i, j);
+    } else {
+      parallel_for(state.width, state.height, resolve);
+    }
+  }
+
+  dgram_scene_bundle make_scene_bundle(const dgram_scene& scene,
+      const dgram_trace_params& params, bool highquality_bvh) {
+    auto bundle   = dgram_scene_bundle{};
+    bundle.shapes = make_shapes(
+        scene, params.camera, params.size, params.scale, params.noparallel);
+    bundle.bvh    = make_bvh(
+        bundle.shapes, highquality_bvh, params.noparallel);
+    bundle.texts  = make_texts(scene, params.camera, params.size,
+        params.scale, params.width, params.height, params.noparallel);
+    return bundle;
+  }
+
+  dgram_trace_state trace_scene(const dgram_scene& scene,
+      const dgram_scene_bundle& bundle, const dgram_trace_params& params) {
+    auto state = make_state(params);
+    for (auto sample = 0; sample < params.samples; sample++)
+      trace_samples(
+          state, scene, bundle.shapes, bundle.texts, bundle.bvh, params);
+    return state;
+  }
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR RENDERING API
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  image_data trace_image(const dgram_scenes& dgram,
+      const dgram_trace_params& params_, bool transparent_background,
+      bool highquality_bvh) {
+    auto params  = params_;
+    params.scale = dgram.scale;
+    params.size  = dgram.size;
+    if (params.width == 0) params.width = 2 * (int)round(dgram.size.x);
+    if (params.height == 0) {
+      auto aspect   = dgram.size.x / dgram.size.y;
+      params.height = (int)round(params.width / aspect);
+    }
+
+    auto image = make_image(params.width, params.height, false);
+    if (!transparent_background)
+      image.pixels = vector<vec4f>(
+          params.width * params.height, vec4f{1, 1, 1, 1});
+
+    for (auto& scene : dgram.scenes) {
+      auto bundle = make_scene_bundle(scene, params, highquality_bvh);
+      composite_render(
+          image, trace_scene(scene, bundle, params), params.noparallel);
+    }
+
+    return image;
+  }
+
 }  // namespace yocto
@@ -75,6 +75,21 @@ namespace yocto {
     bool               noparallel   = false;
   };
 
+  // Shapes, bvh and labels of a scene, as built for rendering
+  struct dgram_scene_bundle {
+    trace_shapes    shapes = {};
+    dgram_scene_bvh bvh    = {};
+    trace_texts     texts  = {};
+  };
+
+  // Renders all the scenes of a diagram, composited in order over a white
+  // background, or a transparent one. The diagram sets the scale and size of
+  // the image, whose resolution defaults to twice the diagram width. Label
+  // images should be loaded before rendering.
+  image_data trace_image(const dgram_scenes& dgram,
+      const dgram_trace_params& params, bool transparent_background = false,
+      bool highquality_bvh = false);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -100,9 +115,31 @@ namespace yocto {
       const dgram_scene_bvh& bvh, int i, int j,
       const dgram_trace_params& params);
 
+  // Traces again the pixels covered by the given texts, with the samples
+  // taken so far, after their images changed
+  void retrace_texts(dgram_trace_state& state, const dgram_scene& scene,
+      const trace_shapes& shapes, const trace_texts& texts,
+      const dgram_scene_bvh& bvh, const trace_texts& regions,
+      const dgram_trace_params& params);
+
   image_data get_render(const dgram_trace_state& state);
   void       get_render(image_data& render, const dgram_trace_state& state);
 
+  // Composites the render over an image in place, resolving the samples in
+  // the same pass, as composite_image(get_render(state), image) would
+  void composite_render(image_data& image, const dgram_trace_state& state,
+      bool noparallel = false);
+
+  // Builds the shapes, bvh and labels of a scene for rendering, as
+  // trace_image does. Label images should be loaded before.
+  dgram_scene_bundle make_scene_bundle(const dgram_scene& scene,
+      const dgram_trace_params& params, bool highquality_bvh = false);
+
+  // Renders a scene from its bundle, taking all the samples of the params.
+  // Renders of many scenes are composited in order.
+  dgram_trace_state trace_scene(const dgram_scene& scene,
+      const dgram_scene_bundle& bundle, const dgram_trace_params& params);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -28,14 +28,71 @@
 
 #include "yocto_dgramio.h"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
 #include <filesystem>
-#include <yocto/ext/json.hpp>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+#include <type_traits>
+#include <unordered_set>
+#include <yocto/ext/fast_float.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
 namespace yocto {
   // using directives
+  using std::string_view;
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// PARALLEL HELPERS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Simple parallel for used since our target platforms do not yet support
+  // parallel algorithms. `Func` takes the integer index.
+  template <typename T, typename Func>
+  inline void parallel_for(T num, Func&& func) {
+    auto              futures  = vector<std::future<void>>{};
+    auto              nthreads = std::thread::hardware_concurrency();
+    std::atomic<T>    next_idx(0);
+    std::atomic<bool> has_error(false);
+    for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
+      futures.emplace_back(
+          std::async(std::launch::async, [&func, &next_idx, &has_error, num]() {
+            try {
+              while (true) {
+                auto idx = next_idx.fetch_add(1);
+                if (idx >= num) break;
+                if (has_error) break;
+                func(idx);
+              }
+            } catch (...) {
+              has_error = true;
+              throw;
+            }
+          }));
+    }
+    for (auto& f : futures) f.get();
+  }
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -62,11 +119,6 @@ namespace yocto {
   static string path_join(const string& patha, const string& pathb) {
     return (make_path(patha) / make_path(pathb)).generic_u8string();
   }
-  static string path_join(
-      const string& patha, const string& pathb, const string& pathc) {
-    return (make_path(patha) / make_path(pathb) / make_path(pathc))
-        .generic_u8string();
-  }
 
   // Check if a file can be opened for reading.
   static bool path_exists(const string& filename) {
@@ -93,131 +145,429 @@ namespace yocto {
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
-// JSON SUPPORT
+// MAPPED FILES
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  // Json values
-  using json_value = nlohmann::ordered_json;
+  // Read-only view of a file mapped in memory, unmapped on destruction
+  struct mapped_file {
+    const byte* data = nullptr;
+    size_t      size = 0;
+
+    mapped_file() = default;
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    ~mapped_file() {
+      if (data == nullptr) return;
+#ifdef _WIN32
+      UnmapViewOfFile(data);
+#else
+      munmap((void*)data, size);
+#endif
+    }
+  };
 
-  // Load/save json
-  static bool load_json(
-      const string& filename, json_value& json, string& error) {
-    auto text = string{};
-    if (!load_text(filename, text, error)) return false;
-    try {
-      json = json_value::parse(text);
-      return true;
-    } catch (...) {
-      error = "cannot parse " + filename;
+  // Maps a file in memory. Empty files are not mapped.
+  static bool map_file(
+      const string& filename, mapped_file& file, string& error) {
+    auto open_error = [&]() {
+      error = filename + ": file not found";
+      return false;
+    };
+    auto map_error = [&]() {
+      error = filename + ": cannot map file";
       return false;
+    };
+
+#ifdef _WIN32
+    auto handle = CreateFileW(make_path(filename).c_str(), GENERIC_READ,
+        FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return open_error();
+    auto size = LARGE_INTEGER{};
+    if (!GetFileSizeEx(handle, &size)) {
+      CloseHandle(handle);
+      return map_error();
     }
+    file.size = (size_t)size.QuadPart;
+    if (file.size == 0) {
+      CloseHandle(handle);
+      return true;
+    }
+    auto mapping = CreateFileMappingW(
+        handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if (mapping == nullptr) return map_error();
+    auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == nullptr) return map_error();
+    file.data = (const byte*)data;
+#else
+    auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return open_error();
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      return map_error();
+    }
+    file.size = (size_t)info.st_size;
+    if (file.size == 0) {
+      close(fd);
+      return true;
+    }
+    auto data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return map_error();
+    file.data = (const byte*)data;
+#endif
+    return true;
   }
-  static bool save_json(
-      const string& filename, const json_value& json, string& error) {
-    return save_text(filename, json.dump(2), error);
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// JSON PARSING
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Values are parsed straight from the file text into the diagram, without
+  // building a document first. Parse functions advance the string view past
+  // the value and fail on malformed input.
+
+  static void skip_whitespace(string_view& str) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\n' ||
+                               str.front() == '\r' || str.front() == '\t'))
+      str.remove_prefix(1);
   }
 
-  // Load/save json
-  [[maybe_unused]] static json_value load_json(const string& filename) {
-    auto error = string{};
-    auto json  = json_value{};
-    if (!load_json(filename, json, error)) throw io_error{error};
-    return json;
+  [[nodiscard]] static bool parse_token(string_view& str, char token) {
+    skip_whitespace(str);
+    if (str.empty() || str.front() != token) return false;
+    str.remove_prefix(1);
+    return true;
   }
-  [[maybe_unused]] static void load_json(
-      const string& filename, json_value& json) {
-    auto error = string{};
-    if (!load_json(filename, json, error)) throw io_error{error};
+
+  [[nodiscard]] static bool parse_literal(
+      string_view& str, string_view literal) {
+    skip_whitespace(str);
+    if (str.substr(0, literal.size()) != literal) return false;
+    str.remove_prefix(literal.size());
+    return true;
   }
-  [[maybe_unused]] static void save_json(
-      const string& filename, const json_value& json) {
-    auto error = string{};
-    if (!save_json(filename, json, error)) throw io_error{error};
+
+  // Appends a code point as utf8
+  static void append_utf8(string& value, uint32_t code) {
+    if (code < 0x80) {
+      value += (char)code;
+    } else if (code < 0x800) {
+      value += (char)(0xc0 | (code >> 6));
+      value += (char)(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+      value += (char)(0xe0 | (code >> 12));
+      value += (char)(0x80 | ((code >> 6) & 0x3f));
+      value += (char)(0x80 | (code & 0x3f));
+    } else {
+      value += (char)(0xf0 | (code >> 18));
+      value += (char)(0x80 | ((code >> 12) & 0x3f));
+      value += (char)(0x80 | ((code >> 6) & 0x3f));
+      value += (char)(0x80 | (code & 0x3f));
+    }
   }
 
-  // Json conversions
-  inline void to_json(json_value& json, const vec2f& value) {
-    nlohmann::to_json(json, (const array<float, 2>&)value);
+  [[nodiscard]] static bool parse_hex(string_view& str, uint32_t& code) {
+    if (str.size() < 4) return false;
+    auto result = std::from_chars(str.data(), str.data() + 4, code, 16);
+    if (result.ptr != str.data() + 4) return false;
+    str.remove_prefix(4);
+    return true;
   }
-  inline void to_json(json_value& json, const vec3f& value) {
-    nlohmann::to_json(json, (const array<float, 3>&)value);
+
+  [[nodiscard]] static bool parse_value(string_view& str, string& value) {
+    if (!parse_token(str, '"')) return false;
+    value.clear();
+    while (true) {
+      // copy the runs without escapes at once
+      auto run = str.find_first_of("\"\\");
+      if (run == string_view::npos) return false;
+      value.append(str.data(), run);
+      str.remove_prefix(run);
+      if (str.front() == '"') break;
+      str.remove_prefix(1);
+      if (str.empty()) return false;
+      auto escape = str.front();
+      str.remove_prefix(1);
+      switch (escape) {
+        case '"': value += '"'; break;
+        case '\\': value += '\\'; break;
+        case '/': value += '/'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'n': value += '\n'; break;
+        case 'r': value += '\r'; break;
+        case 't': value += '\t'; break;
+        case 'u': {
+          auto code = (uint32_t)0;
+          if (!parse_hex(str, code)) return false;
+          // surrogate pairs
+          if (code >= 0xd800 && code < 0xdc00) {
+            auto low = (uint32_t)0;
+            if (!parse_literal(str, "\\u") || !parse_hex(str, low))
+              return false;
+            if (low < 0xdc00 || low >= 0xe000) return false;
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          }
+          append_utf8(value, code);
+        } break;
+        default: return false;
+      }
+    }
+    str.remove_prefix(1);
+    return true;
   }
-  inline void to_json(json_value& json, const vec4f& value) {
-    nlohmann::to_json(json, (const array<float, 4>&)value);
+
+  // Numbers are read as doubles, and then converted, as in JSON libraries
+  [[nodiscard]] static bool parse_value(string_view& str, double& value) {
+    skip_whitespace(str);
+    auto result = fast_float::from_chars(
+        str.data(), str.data() + str.size(), value);
+    if (result.ptr == str.data()) return false;
+    str.remove_prefix(result.ptr - str.data());
+    return true;
   }
-  inline void to_json(json_value& json, const frame2f& value) {
-    nlohmann::to_json(json, (const array<float, 6>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, float& value) {
+    auto valued = 0.0;
+    if (!parse_value(str, valued)) return false;
+    value = (float)valued;
+    return true;
   }
-  inline void to_json(json_value& json, const frame3f& value) {
-    nlohmann::to_json(json, (const array<float, 12>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, int& value) {
+    skip_whitespace(str);
+    auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (result.ptr == str.data()) return false;
+    auto next = string_view{result.ptr, str.size() - (result.ptr - str.data())};
+    if (next.empty() || (next.front() != '.' && next.front() != 'e' &&
+                            next.front() != 'E')) {
+      str = next;
+      return true;
+    }
+    // numbers with a fraction are truncated
+    auto valued = 0.0;
+    if (!parse_value(str, valued)) return false;
+    value = (int)valued;
+    return true;
   }
-  inline void to_json(json_value& json, const mat2f& value) {
-    nlohmann::to_json(json, (const array<float, 4>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, size_t& value) {
+    skip_whitespace(str);
+    auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (result.ptr == str.data()) return false;
+    auto next = string_view{result.ptr, str.size() - (result.ptr - str.data())};
+    if (next.empty() || (next.front() != '.' && next.front() != 'e' &&
+                            next.front() != 'E')) {
+      str = next;
+      return true;
+    }
+    // numbers with a fraction or an exponent must be whole
+    auto valued = 0.0;
+    if (!parse_value(str, valued)) return false;
+    if (valued < 0 || valued != std::floor(valued) ||
+        valued >= (double)std::numeric_limits<size_t>::max())
+      return false;
+    value = (size_t)valued;
+    return true;
   }
-  inline void to_json(json_value& json, const mat3f& value) {
-    nlohmann::to_json(json, (const array<float, 9>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, bool& value) {
+    if (parse_literal(str, "true")) {
+      value = true;
+      return true;
+    } else if (parse_literal(str, "false")) {
+      value = false;
+      return true;
+    } else {
+      return false;
+    }
   }
-  inline void to_json(json_value& json, const mat4f& value) {
-    nlohmann::to_json(json, (const array<float, 16>&)value);
+
+  // Skips a value of any type
+  [[nodiscard]] static bool skip_value(string_view& str) {
+    skip_whitespace(str);
+    if (str.empty()) return false;
+    if (str.front() == '"') {
+      auto value = string{};
+      return parse_value(str, value);
+    } else if (str.front() == '[' || str.front() == '{') {
+      auto depth = 0;
+      while (!str.empty()) {
+        auto c = str.front();
+        if (c == '"') {
+          auto value = string{};
+          if (!parse_value(str, value)) return false;
+          continue;
+        }
+        str.remove_prefix(1);
+        if (c == '[' || c == '{') depth++;
+        if (c == ']' || c == '}') depth--;
+        if (depth == 0) return true;
+      }
+      return false;
+    } else if (parse_literal(str, "null") || parse_literal(str, "true") ||
+               parse_literal(str, "false")) {
+      return true;
+    } else {
+      auto value = 0.0;
+      return parse_value(str, value);
+    }
   }
-  inline void from_json(const json_value& json, vec2f& value) {
-    nlohmann::from_json(json, (array<float, 2>&)value);
+
+  // Parses the elements of an array with `func(str)`
+  template <typename Func>
+  [[nodiscard]] static bool parse_array(string_view& str, Func&& func) {
+    if (!parse_token(str, '[')) return false;
+    if (parse_token(str, ']')) return true;
+    while (true) {
+      if (!func(str)) return false;
+      if (parse_token(str, ']')) return true;
+      if (!parse_token(str, ',')) return false;
+    }
   }
-  inline void from_json(const json_value& json, vec3f& value) {
-    nlohmann::from_json(json, (array<float, 3>&)value);
+
+  // Parses the members of an object with `func(str, key)`
+  template <typename Func>
+  [[nodiscard]] static bool parse_object(string_view& str, Func&& func) {
+    if (!parse_token(str, '{')) return false;
+    if (parse_token(str, '}')) return true;
+    auto key = string{};
+    while (true) {
+      if (!parse_value(str, key)) return false;
+      if (!parse_token(str, ':')) return false;
+      if (!func(str, key)) return false;
+      if (parse_token(str, '}')) return true;
+      if (!parse_token(str, ',')) return false;
+    }
   }
-  inline void from_json(const json_value& json, vec4f& value) {
-    nlohmann::from_json(json, (array<float, 4>&)value);
+
+  // Counts the elements of an array, to reserve storage for them
+  static size_t count_array(string_view str) {
+    skip_whitespace(str);
+    if (str.empty() || str.front() != '[') return 0;
+    str.remove_prefix(1);
+    skip_whitespace(str);
+    if (!str.empty() && str.front() == ']') return 0;
+    auto count = (size_t)1, depth = (size_t)0;
+    for (auto idx = (size_t)0; idx < str.size(); idx++) {
+      auto c = str[idx];
+      if (c == '"') {
+        // escapes are skipped with the character they escape, so that runs
+        // of backslashes end strings correctly
+        for (idx++; idx < str.size() && str[idx] != '"'; idx++)
+          if (str[idx] == '\\') idx++;
+      } else if (c == '[' || c == '{') {
+        depth++;
+      } else if (c == ']' || c == '}') {
+        if (depth == 0) break;
+        depth--;
+      } else if (c == ',' && depth == 0) {
+        count++;
+      }
+    }
+    return count;
   }
-  inline void from_json(const json_value& json, vec2i& value) {
-    nlohmann::from_json(json, (array<int, 2>&)value);
+
+  // Fixed size arrays, with extra elements ignored
+  template <typename T, size_t N>
+  [[nodiscard]] static bool parse_values(string_view& str, T* values) {
+    auto count = (size_t)0;
+    if (!parse_array(str, [&](string_view& str) {
+          if (count >= N) return skip_value(str);
+          return parse_value(str, values[count++]);
+        }))
+      return false;
+    return count >= N;
   }
-  inline void from_json(const json_value& json, vec3i& value) {
-    nlohmann::from_json(json, (array<int, 3>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, vec2f& value) {
+    return parse_values<float, 2>(str, &value.x);
   }
-  inline void from_json(const json_value& json, vec4i& value) {
-    nlohmann::from_json(json, (array<int, 4>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, vec3f& value) {
+    return parse_values<float, 3>(str, &value.x);
   }
-  inline void from_json(const json_value& json, frame2f& value) {
-    nlohmann::from_json(json, (array<float, 6>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, vec4f& value) {
+    return parse_values<float, 4>(str, &value.x);
   }
-  inline void from_json(const json_value& json, frame3f& value) {
-    nlohmann::from_json(json, (array<float, 12>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, vec2i& value) {
+    return parse_values<int, 2>(str, &value.x);
   }
-  inline void from_json(const json_value& json, mat2f& value) {
-    nlohmann::from_json(json, (array<float, 4>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, vec3i& value) {
+    return parse_values<int, 3>(str, &value.x);
   }
-  inline void from_json(const json_value& json, mat3f& value) {
-    nlohmann::from_json(json, (array<float, 9>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, vec4i& value) {
+    return parse_values<int, 4>(str, &value.x);
   }
-  inline void from_json(const json_value& json, mat4f& value) {
-    nlohmann::from_json(json, (array<float, 16>&)value);
+  [[nodiscard]] static bool parse_value(string_view& str, frame3f& value) {
+    return parse_values<float, 12>(str, &value.x.x);
   }
 
-  inline void from_json(const json_value& json, line_ends& value) {
-    nlohmann::from_json(json, (array<line_end, 2>&)value);
+  // Enums are named by strings, with unknown names mapped to the first value
+  template <typename T>
+  [[nodiscard]] static bool parse_enum(
+      string_view& str, T& value, const vector<string>& names) {
+    auto name = string{};
+    if (!parse_value(str, name)) return false;
+    auto pos = std::find(names.begin(), names.end(), name);
+    value    = pos == names.end() ? (T)0 : (T)(pos - names.begin());
+    return true;
+  }
+  [[nodiscard]] static bool parse_value(string_view& str, line_end& value) {
+    static const auto names = vector<string>{
+        "cap", "stealth_arrow", "triangle_arrow"};
+    return parse_enum(str, value, names);
+  }
+  [[nodiscard]] static bool parse_value(string_view& str, dashed_line& value) {
+    return parse_enum(str, value, dashed_line_names);
+  }
+  [[nodiscard]] static bool parse_value(
+      string_view& str, dash_cap_type& value) {
+    return parse_enum(str, value, dash_cap_type_names);
+  }
+  [[nodiscard]] static bool parse_value(string_view& str, line_ends& value) {
+    return parse_values<line_end, 2>(str, &value.a);
   }
 
-  NLOHMANN_JSON_SERIALIZE_ENUM(
-      line_end, {
-                    {line_end::cap, "cap"},
-                    {line_end::stealth_arrow, "stealth_arrow"},
-                    {line_end::triangle_arrow, "triangle_arrow"},
-                })
-
-  NLOHMANN_JSON_SERIALIZE_ENUM(
-      dashed_line, {
-                       {dashed_line::always, "always"},
-                       {dashed_line::never, "never"},
-                       {dashed_line::transparency, "transparency"},
-                   })
+  // Arrays of values, parsed into reserved storage
+  template <typename T>
+  [[nodiscard]] static bool parse_value(string_view& str, vector<T>& values) {
+    values.clear();
+    values.reserve(count_array(str));
+    return parse_array(str, [&](string_view& str) {
+      return parse_value(str, values.emplace_back());
+    });
+  }
 
-  NLOHMANN_JSON_SERIALIZE_ENUM(
-      dash_cap_type, {
-                         {dash_cap_type::round, "round"},
-                         {dash_cap_type::square, "square"},
-                     })
+  // Arrays of values, either inlined or stored in a binary buffer as
+  // `{"buffer": index, "offset": bytes, "count": values}`. Buffers hold
+  // little-endian values, tightly packed, and are copied without parsing.
+  template <typename T>
+  [[nodiscard]] static bool parse_value(string_view& str, vector<T>& values,
+      const vector<mapped_file>& buffers) {
+    static_assert(std::is_trivially_copyable_v<T>, "cannot copy values");
+    skip_whitespace(str);
+    if (str.empty() || str.front() != '{') return parse_value(str, values);
+    auto buffer = -1;
+    auto offset = (size_t)0, count = (size_t)0;
+    if (!parse_object(str, [&](string_view& str, const string& key) {
+          if (key == "buffer") return parse_value(str, buffer);
+          if (key == "offset") return parse_value(str, offset);
+          if (key == "count") return parse_value(str, count);
+          return skip_value(str);
+        }))
+      return false;
+    if (buffer < 0 || buffer >= (int)buffers.size()) return false;
+    auto& file = buffers[buffer];
+    if (offset > file.size || count > (file.size - offset) / sizeof(T))
+      return false;
+    values.resize(count);
+    if (count != 0)
+      memcpy(values.data(), file.data + offset, count * sizeof(T));
+    return true;
+  }
 
 }  // namespace yocto
 
@@ -226,167 +576,680 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+  [[nodiscard]] static bool parse_value(
+      string_view& str, dgram_camera& camera) {
+    return parse_object(str, [&](string_view& str, const string& key) {
+      if (key == "orthographic") return parse_value(str, camera.orthographic);
+      if (key == "center") return parse_value(str, camera.center);
+      if (key == "from") return parse_value(str, camera.from);
+      if (key == "to") return parse_value(str, camera.to);
+      if (key == "lens") return parse_value(str, camera.lens);
+      return skip_value(str);
+    });
+  }
+
+  [[nodiscard]] static bool parse_value(
+      string_view& str, dgram_object& object) {
+    return parse_object(str, [&](string_view& str, const string& key) {
+      if (key == "frame") return parse_value(str, object.frame);
+      if (key == "shape") return parse_value(str, object.shape);
+      if (key == "material") return parse_value(str, object.material);
+      if (key == "labels") return parse_value(str, object.labels);
+      return skip_value(str);
+    });
+  }
+
+  [[nodiscard]] static bool parse_value(
+      string_view& str, dgram_material& material) {
+    return parse_object(str, [&](string_view& str, const string& key) {
+      if (key == "fill") return parse_value(str, material.fill);
+      if (key == "stroke") return parse_value(str, material.stroke);
+      if (key == "thickness") return parse_value(str, material.thickness);
+      if (key == "dash_period") return parse_value(str, material.dash_period);
+      if (key == "dash_phase") return parse_value(str, material.dash_phase);
+      if (key == "dash_on") return parse_value(str, material.dash_on);
+      if (key == "dash_cap") return parse_value(str, material.dash_cap);
+      if (key == "dashed") return parse_value(str, material.dashed);
+      return skip_value(str);
+    });
+  }
+
+  [[nodiscard]] static bool parse_value(string_view& str, dgram_shape& shape,
+      const vector<mapped_file>& buffers) {
+    return parse_object(str, [&](string_view& str, const string& key) {
+      if (key == "points") return parse_value(str, shape.points, buffers);
+      if (key == "triangles") return parse_value(str, shape.triangles, buffers);
+      if (key == "quads") return parse_value(str, shape.quads, buffers);
+      if (key == "positions") return parse_value(str, shape.positions, buffers);
+      if (key == "fills") return parse_value(str, shape.fills, buffers);
+      if (key == "cull") return parse_value(str, shape.cull);
+      if (key == "boundary") return parse_value(str, shape.boundary);
+      if (key == "lines") return parse_value(str, shape.lines, buffers);
+      if (key == "ends") return parse_value(str, shape.ends);
+      return skip_value(str);
+    });
+  }
+
+  [[nodiscard]] static bool parse_value(string_view& str, dgram_label& label) {
+    return parse_object(str, [&](string_view& str, const string& key) {
+      if (key == "positions") return parse_value(str, label.positions);
+      if (key != "labels") return skip_value(str);
+      return parse_array(str, [&](string_view& str) {
+        // the name defaults to the text, that may come later
+        auto text      = string{};
+        auto offset    = vec2f{0, 0};
+        auto alignment = 0.0f;
+        auto name      = string{};
+        auto has_name  = false;
+        if (!parse_object(str, [&](string_view& str, const string& key) {
+              if (key == "unprocessed") return parse_value(str, text);
+              if (key == "offset") return parse_value(str, offset);
+              if (key == "alignment") return parse_value(str, alignment);
+              if (key == "name") {
+                has_name = true;
+                return parse_value(str, name);
+              }
+              return skip_value(str);
+            }))
+          return false;
+        if (text == "") return true;
+        label.texts.push_back(text);
+        label.offsets.push_back(offset);
+        label.alignments.push_back(alignment);
+        label.names.push_back(has_name ? name : escape_string(text));
+        return true;
+      });
+    });
+  }
+
+  [[nodiscard]] static bool parse_value(string_view& str, dgram_scene& scene,
+      const vector<mapped_file>& buffers) {
+    return parse_object(str, [&](string_view& str, const string& key) {
+      if (key == "offset") return parse_value(str, scene.offset);
+      if (key == "cameras") return parse_value(str, scene.cameras);
+      if (key == "objects") return parse_value(str, scene.objects);
+      if (key == "materials") return parse_value(str, scene.materials);
+      if (key == "labels") return parse_value(str, scene.labels);
+      if (key != "shapes") return skip_value(str);
+      scene.shapes.clear();
+      scene.shapes.reserve(count_array(str));
+      return parse_array(str, [&](string_view& str) {
+        return parse_value(str, scene.shapes.emplace_back(), buffers);
+      });
+    });
+  }
+
+  // Parses a diagram, with buffers relative to a directory and errors
+  // reported with its name
+  static bool parse_json_dgram(string_view text, const string& name,
+      const string& dirname, dgram_scenes& dgram, string& error) {
+    // the scenes are only delimited here, and parsed later in parallel
+    auto str     = string_view{text};
+    auto jscenes = vector<string_view>{};
+    auto uris    = vector<string>{};
+    auto parsed  = parse_object(str, [&](string_view& str, const string& key) {
+      if (key == "size") return parse_value(str, dgram.size);
+      if (key == "resolution") return parse_value(str, dgram.scale);
+      if (key == "buffers") {
+        uris.clear();
+        return parse_array(str, [&](string_view& str) {
+          auto& uri = uris.emplace_back();
+          return parse_object(str, [&](string_view& str, const string& key) {
+            if (key == "uri") return parse_value(str, uri);
+            return skip_value(str);
+          });
+        });
+      }
+      if (key != "scenes") return skip_value(str);
+      jscenes.clear();
+      return parse_array(str, [&](string_view& str) {
+        skip_whitespace(str);
+        auto start = str;
+        if (!skip_value(str)) return false;
+        jscenes.push_back(start.substr(0, start.size() - str.size()));
+        return true;
+      });
+    });
+    skip_whitespace(str);
+    if (!parsed || !str.empty()) {
+      error = "cannot parse " + name;
+      return false;
+    }
+
+    // binary buffers, that must be inside the directory of the diagram
+    auto buffers = vector<mapped_file>(uris.size());
+    for (auto idx = (size_t)0; idx < uris.size(); idx++) {
+      auto uri     = make_path(uris[idx]);
+      auto outside = uri.empty() || uri.has_root_name() ||
+                     uri.has_root_directory();
+      for (auto& part : uri) outside = outside || part == "..";
+      if (outside) {
+        error = name + ": buffer outside the diagram directory " + uris[idx];
+        return false;
+      }
+      auto path = path_join(dirname, uris[idx]);
+      if (!map_file(path, buffers[idx], error)) return false;
+    }
+
+    // parsing scenes
+    dgram.scenes.resize(jscenes.size());
+    auto failed = std::atomic<bool>{false};
+    parallel_for(jscenes.size(), [&](size_t idx) {
+      if (!parse_value(jscenes[idx], dgram.scenes[idx], buffers)) failed = true;
+      update_label_images(dgram.scenes[idx]);
+    });
+    if (failed) {
+      error = "cannot parse " + name;
+      return false;
+    }
+
+    return true;
+  }
+
   static bool load_json_dgram(
       const string& filename, dgram_scenes& dgram, string& error) {
     // open file
-    auto json = json_value{};
-    if (!load_json(filename, json, error)) return false;
+    auto text = string{};
+    if (!load_text(filename, text, error)) return false;
 
-    auto get_opt = [](const json_value& json, const string& key, auto& value) {
-      value = json.value(key, value);
-    };
+    // buffers are relative to the diagram
+    return parse_json_dgram(
+        text, filename, path_dirname(filename), dgram, error);
+  }
 
-    // parsing values
-    try {
-      get_opt(json, "size", dgram.size);
-      get_opt(json, "resolution", dgram.scale);
+  bool parse_dgram(const string& text, dgram_scenes& dgram, string& error,
+      const string& dirname) {
+    return parse_json_dgram(text, "diagram", dirname, dgram, error);
+  }
 
-      if (json.contains("scenes")) {
-        auto& jscenes = json.at("scenes");
-        dgram.scenes.reserve(jscenes.size());
+  dgram_scenes parse_dgram(const string& text, const string& dirname) {
+    auto error = string{};
+    auto dgram = dgram_scenes{};
+    if (!parse_dgram(text, dgram, error, dirname)) throw io_error{error};
+    return dgram;
+  }
 
-        for (auto& jscene : jscenes) {
-          auto& scene = dgram.scenes.emplace_back();
+  bool load_dgram(const string& filename, dgram_scenes& dgram, string& error) {
+    auto ext = path_extension(filename);
+    if (ext == ".json" || ext == ".JSON") {
+      return load_json_dgram(filename, dgram, error);
+    } else {
+      error = "unsupported format " + filename;
+      return false;
+    }
+  }
 
-          get_opt(jscene, "offset", scene.offset);
+  dgram_scenes load_dgram(const string& filename) {
+    auto error = string{};
+    auto dgram = dgram_scenes{};
+    if (!load_dgram(filename, dgram, error)) throw io_error{error};
+    return dgram;
+  }
 
-          if (jscene.contains("cameras")) {
-            auto& jcameras = jscene.at("cameras");
-            scene.cameras.reserve(jcameras.size());
+}  // namespace yocto
 
-            for (auto& jcamera : jcameras) {
-              auto& camera = scene.cameras.emplace_back();
+// -----------------------------------------------------------------------------
+// DGRAM IMAGES
+// -----------------------------------------------------------------------------
+namespace yocto {
 
-              get_opt(jcamera, "orthographic", camera.orthographic);
-              get_opt(jcamera, "center", camera.center);
-              get_opt(jcamera, "from", camera.from);
-              get_opt(jcamera, "to", camera.to);
-              get_opt(jcamera, "lens", camera.lens);
-            }
+  // Linear values to sRGB bytes, with the same results as rgb_to_srgb and
+  // float_to_byte. A coarse table gives the byte or the one below it, that is
+  // raised with the smallest linear value of each byte.
+  struct srgb_table {
+    static const int   size       = 4096;
+    array<byte, size>  coarse     = {};
+    array<float, 257>  thresholds = {};
+  };
+
+  static const srgb_table& get_srgb_table() {
+    static const auto table = []() {
+      auto table = srgb_table{};
+      for (auto b = 1; b < 256; b++) {
+        // bisect the bits of positive floats, that are ordered as the values
+        auto lo = (uint32_t)0, hi = (uint32_t)0x3f800000;
+        while (lo < hi) {
+          auto mid   = lo + (hi - lo) / 2;
+          auto value = 0.0f;
+          memcpy(&value, &mid, sizeof(value));
+          if (float_to_byte(rgb_to_srgb(value)) >= b) {
+            hi = mid;
+          } else {
+            lo = mid + 1;
           }
+        }
+        memcpy(&table.thresholds[b], &lo, sizeof(lo));
+      }
+      table.thresholds[256] = flt_max;
+      for (auto idx = 0; idx < srgb_table::size; idx++)
+        table.coarse[idx] = float_to_byte(
+            rgb_to_srgb(idx / (float)srgb_table::size));
+      return table;
+    }();
+    return table;
+  }
 
-          if (jscene.contains("objects")) {
-            auto& jobjects = jscene.at("objects");
-            scene.objects.reserve(jobjects.size());
+  static byte linear_to_byte(const srgb_table& table, float value) {
+    if (!(value > 0)) return 0;
+    if (value >= 1) return 255;
+    auto b = table.coarse[(int)(value * srgb_table::size)];
+    return (byte)(b + (value >= table.thresholds[b + 1]));
+  }
 
-            for (auto& jobject : jobjects) {
-              auto& object = scene.objects.emplace_back();
+  // Converts a row of a rendered image to 8-bit sRGB pixels
+  static void make_image_row(const image_data& image, int j, byte* row) {
+    // byte stores may alias the image, so its fields are read once
+    auto width  = image.width;
+    auto pixels = image.pixels.data() + (size_t)j * width;
+    auto bytes  = (vec4b*)row;
+    if (!image.linear) {
+      float_to_byte(bytes, pixels, width);
+      return;
+    }
+    auto& table = get_srgb_table();
+    for (auto i = 0; i < width; i++) {
+      auto& pixel = pixels[i];
+      bytes[i]    = {linear_to_byte(table, pixel.x),
+          linear_to_byte(table, pixel.y), linear_to_byte(table, pixel.z),
+          float_to_byte(pixel.w)};
+    }
+  }
 
-              get_opt(jobject, "frame", object.frame);
-              get_opt(jobject, "shape", object.shape);
-              get_opt(jobject, "material", object.material);
-              get_opt(jobject, "labels", object.labels);
-            }
-          }
+  vector<vec4b> make_image_bytes(const image_data& image) {
+    // rows are converted in parallel
+    auto pixels = vector<vec4b>(image.pixels.size());
+    parallel_for(image.height, [&](int j) {
+      auto row = (byte*)(pixels.data() + (size_t)j * image.width);
+      make_image_row(image, j, row);
+    });
+    return pixels;
+  }
 
-          if (jscene.contains("materials")) {
-            auto& jmaterials = jscene.at("materials");
-            scene.materials.reserve(jmaterials.size());
+}  // namespace yocto
 
-            for (auto& jmaterial : jmaterials) {
-              auto& material = scene.materials.emplace_back();
+// -----------------------------------------------------------------------------
+// PNG ENCODING
+// -----------------------------------------------------------------------------
+namespace yocto {
 
-              get_opt(jmaterial, "fill", material.fill);
-              get_opt(jmaterial, "stroke", material.stroke);
+  // Deflate streams are written least significant bit first
+  struct deflate_writer {
+    vector<byte> data  = {};
+    uint32_t     bits  = 0;
+    int          count = 0;
+  };
+
+  static void write_bits(deflate_writer& writer, uint32_t value, int count) {
+    writer.bits |= value << writer.count;
+    writer.count += count;
+    while (writer.count >= 8) {
+      writer.data.push_back((byte)(writer.bits & 0xff));
+      writer.bits >>= 8;
+      writer.count -= 8;
+    }
+  }
 
-              get_opt(jmaterial, "thickness", material.thickness);
+  // Ends a band with an empty stored block, that aligns it to a byte
+  static void write_sync(deflate_writer& writer) {
+    write_bits(writer, 0, 3);
+    if (writer.count > 0) write_bits(writer, 0, 8 - writer.count);
+    writer.data.insert(writer.data.end(), {0x00, 0x00, 0xff, 0xff});
+  }
 
-              get_opt(jmaterial, "dash_period", material.dash_period);
-              get_opt(jmaterial, "dash_phase", material.dash_phase);
-              get_opt(jmaterial, "dash_on", material.dash_on);
-              get_opt(jmaterial, "dash_cap", material.dash_cap);
+  // Huffman codes are written starting from their most significant bit
+  static uint16_t reverse_bits(uint32_t code, int count) {
+    auto reversed = (uint32_t)0;
+    for (auto bit = 0; bit < count; bit++) {
+      reversed = (reversed << 1) | (code & 1);
+      code >>= 1;
+    }
+    return (uint16_t)reversed;
+  }
 
-              get_opt(jmaterial, "dashed", material.dashed);
-            }
-          }
+  // Symbols use the fixed Huffman codes, stored bit-reversed
+  struct deflate_code {
+    uint16_t code  = 0;
+    uint8_t  count = 0;
+  };
+  static const array<deflate_code, 288>& get_deflate_codes() {
+    static const auto codes = []() {
+      auto codes   = array<deflate_code, 288>{};
+      for (auto symbol = 0; symbol < 288; symbol++) {
+        if (symbol <= 143) {
+          codes[symbol] = {reverse_bits(0x30 + symbol, 8), 8};
+        } else if (symbol <= 255) {
+          codes[symbol] = {reverse_bits(0x190 + symbol - 144, 9), 9};
+        } else if (symbol <= 279) {
+          codes[symbol] = {reverse_bits(symbol - 256, 7), 7};
+        } else {
+          codes[symbol] = {reverse_bits(0xc0 + symbol - 280, 8), 8};
+        }
+      }
+      return codes;
+    }();
+    return codes;
+  }
 
-          if (jscene.contains("shapes")) {
-            auto& jshapes = jscene.at("shapes");
-            scene.shapes.reserve(jshapes.size());
+  static void write_symbol(deflate_writer& writer,
+      const array<deflate_code, 288>& codes, int symbol) {
+    write_bits(writer, codes[symbol].code, codes[symbol].count);
+  }
 
-            for (auto& jshape : jshapes) {
-              auto& shape = scene.shapes.emplace_back();
+  static void write_match(deflate_writer& writer,
+      const array<deflate_code, 288>& codes, int length, int distance) {
+    static const uint16_t length_bases[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13,
+        15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195,
+        227, 258, 259};
+    static const uint8_t  length_extras[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1,
+        1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t distance_bases[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25,
+        33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577, 32769};
+    static const uint8_t  distance_extras[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3,
+        4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    auto lcode = 0;
+    while (length_bases[lcode + 1] <= length) lcode++;
+    write_symbol(writer, codes, 257 + lcode);
+    write_bits(writer, length - length_bases[lcode], length_extras[lcode]);
+    auto dcode = 0;
+    while (distance_bases[dcode + 1] <= distance) dcode++;
+    write_bits(writer, reverse_bits(dcode, 5), 5);
+    write_bits(
+        writer, distance - distance_bases[dcode], distance_extras[dcode]);
+  }
 
-              get_opt(jshape, "points", shape.points);
-              get_opt(jshape, "triangles", shape.triangles);
-              get_opt(jshape, "quads", shape.quads);
+  // Compresses a band as a non-final block, with matches found on hash
+  // chains whose length depends on the level. Higher levels also defer
+  // matches when the next byte starts a longer one.
+  static void deflate_band(
+      deflate_writer& writer, const byte* data, int size, int level) {
+    // stored blocks
+    if (level <= 0) {
+      for (auto start = 0; start < size || start == 0; start += 65535) {
+        auto length = std::min(size - start, 65535);
+        write_bits(writer, 0, 3);
+        if (writer.count > 0) write_bits(writer, 0, 8 - writer.count);
+        write_bits(writer, (uint32_t)length, 16);
+        write_bits(writer, (uint32_t)(~length & 0xffff), 16);
+        writer.data.insert(
+            writer.data.end(), data + start, data + start + length);
+        if (size == 0) break;
+      }
+      return;
+    }
 
-              get_opt(jshape, "positions", shape.positions);
-              get_opt(jshape, "fills", shape.fills);
+    static const int chains[] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+    auto             chain    = chains[std::min(level, 9)];
+    auto             lazy     = level >= 4;
+    auto&            codes    = get_deflate_codes();
+
+    const auto hash_bits = 15, window = 32768, max_match = 258;
+    auto       head      = vector<int>(1 << hash_bits, -1);
+    auto       prev      = vector<int>(size, -1);
+    auto       hash      = [&](int i) {
+      auto value = (uint32_t)data[i] | ((uint32_t)data[i + 1] << 8) |
+                   ((uint32_t)data[i + 2] << 16);
+      return (int)((value * 2654435761u) >> (32 - hash_bits));
+    };
+    auto insert = [&](int i) {
+      auto h  = hash(i);
+      prev[i] = head[h];
+      head[h] = i;
+    };
+    auto find = [&](int i, int& distance) {
+      auto best  = 0;
+      auto limit = std::min(max_match, size - i);
+      auto tries = chain;
+      for (auto candidate = head[hash(i)];
+           candidate >= 0 && i - candidate <= window && tries-- > 0;
+           candidate = prev[candidate]) {
+        auto length = 0;
+        while (length < limit && data[candidate + length] == data[i + length])
+          length++;
+        if (length > best) {
+          best     = length;
+          distance = i - candidate;
+          if (length == limit) break;
+        }
+      }
+      return best >= 3 ? best : 0;
+    };
 
-              get_opt(jshape, "cull", shape.cull);
-              get_opt(jshape, "boundary", shape.boundary);
+    // block header, not final with fixed codes
+    write_bits(writer, 0b010, 3);
+    auto i = 0;
+    while (i + 3 <= size) {
+      auto distance = 0;
+      auto length   = find(i, distance);
+      insert(i);
+      if (length != 0 && lazy && i + 4 <= size && length < max_match) {
+        auto next_distance = 0;
+        if (find(i + 1, next_distance) > length) length = 0;
+      }
+      if (length == 0) {
+        write_symbol(writer, codes, data[i]);
+        i += 1;
+        continue;
+      }
+      write_match(writer, codes, length, distance);
+      if (level > 2) {
+        for (auto k = i + 1; k < i + length && k + 3 <= size; k++) insert(k);
+      }
+      i += length;
+    }
+    for (; i < size; i++) write_symbol(writer, codes, data[i]);
+    write_symbol(writer, codes, 256);
+  }
 
-              get_opt(jshape, "lines", shape.lines);
-              get_opt(jshape, "ends", shape.ends);
-            }
-          }
+  // Checksums of the stream and of the chunks
+  static uint32_t adler32(const byte* data, size_t size) {
+    auto a = (uint32_t)1, b = (uint32_t)0;
+    while (size > 0) {
+      // sums do not overflow in 5552 bytes
+      auto count = std::min(size, (size_t)5552);
+      for (auto idx = (size_t)0; idx < count; idx++) {
+        a += data[idx];
+        b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+      data += count;
+      size -= count;
+    }
+    return (b << 16) | a;
+  }
+  static uint32_t adler32_combine(
+      uint32_t adler1, uint32_t adler2, size_t size2) {
+    const auto base = (uint32_t)65521;
+    auto       rem  = (uint32_t)(size2 % base);
+    auto       sum1 = adler1 & 0xffff;
+    auto       sum2 = (uint32_t)(((uint64_t)rem * sum1) % base);
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+    return sum1 | (sum2 << 16);
+  }
+  static uint32_t crc32(const byte* data, size_t size, uint32_t crc = 0) {
+    static const auto table = []() {
+      auto table = array<uint32_t, 256>{};
+      for (auto n = (uint32_t)0; n < 256; n++) {
+        auto c = n;
+        for (auto k = 0; k < 8; k++)
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : (c >> 1);
+        table[n] = c;
+      }
+      return table;
+    }();
+    crc = ~crc;
+    for (auto idx = (size_t)0; idx < size; idx++)
+      crc = table[(crc ^ data[idx]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+  }
 
-          if (jscene.contains("labels")) {
-            auto& jlabels = jscene.at("labels");
-            scene.labels.reserve(jlabels.size());
-
-            for (auto i = 0; i < jlabels.size(); i++) {
-              auto& jlabel = jlabels[i];
-              auto& label  = scene.labels.emplace_back();
-
-              get_opt(jlabel, "positions", label.positions);
-
-              if (jlabel.contains("labels")) {
-                for (auto j = 0; j < jlabel.at("labels").size(); j++) {
-                  auto& elem = jlabel.at("labels")[j];
-
-                  auto text = string("");
-                  get_opt(elem, "unprocessed", text);
-
-                  if (text != "") {
-                    label.texts.emplace_back(text);
-                    auto& offset    = label.offsets.emplace_back(vec2f{0, 0});
-                    auto& alignment = label.alignments.emplace_back(0.0f);
-                    auto& image     = label.images.emplace_back();
-                    auto& name = label.names.emplace_back(escape_string(text));
-
-                    get_opt(elem, "offset", offset);
-                    get_opt(elem, "alignment", alignment);
-                    get_opt(elem, "name", name);
-
-                    try {
-                      load_image(path_join(path_dirname(filename), "labels",
-                                     name + ".png"),
-                          image);
-                    } catch (const io_error& e) {
-                    }
-                  }
-                }
-              }
-            }
-          }
-        }
+  static void write_uint32(vector<byte>& data, uint32_t value) {
+    data.insert(data.end(), {(byte)(value >> 24), (byte)(value >> 16),
+                                (byte)(value >> 8), (byte)value});
+  }
+  static void write_chunk(
+      vector<byte>& png, const char* type, const vector<byte>& data) {
+    write_uint32(png, (uint32_t)data.size());
+    auto start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    write_uint32(png, crc32(png.data() + start, png.size() - start));
+  }
+
+  // Filters a row of 4-byte pixels, after the previous one
+  static void filter_row(byte* filtered, const byte* row, const byte* above,
+      int size, png_filter filter) {
+    auto paeth = [](int a, int b, int c) {
+      auto p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+      if (pa <= pb && pa <= pc) return a;
+      return pb <= pc ? b : c;
+    };
+    filtered[0] = (byte)filter - 1;
+    for (auto idx = 0; idx < size; idx++) {
+      int x = row[idx], a = idx >= 4 ? row[idx - 4] : 0;
+      int b = above ? above[idx] : 0;
+      int c = above && idx >= 4 ? above[idx - 4] : 0;
+      switch (filter) {
+        case png_filter::none: filtered[idx + 1] = (byte)x; break;
+        case png_filter::sub: filtered[idx + 1] = (byte)(x - a); break;
+        case png_filter::up: filtered[idx + 1] = (byte)(x - b); break;
+        case png_filter::average:
+          filtered[idx + 1] = (byte)(x - (a + b) / 2);
+          break;
+        case png_filter::paeth:
+          filtered[idx + 1] = (byte)(x - paeth(a, b, c));
+          break;
+        default: break;
       }
+    }
+  }
 
-    } catch (...) {
-      error = "cannot parse " + filename;
+  // Picks the filter with the smallest sum of signed bytes
+  static void filter_row(
+      byte* filtered, const byte* row, const byte* above, int size) {
+    auto best = std::numeric_limits<int>::max();
+    auto temp = vector<byte>(size + 1);
+    for (auto filter : {png_filter::none, png_filter::sub, png_filter::up,
+             png_filter::average, png_filter::paeth}) {
+      filter_row(temp.data(), row, above, size, filter);
+      auto sum = 0;
+      for (auto idx = 1; idx <= size; idx++) sum += abs((int8_t)temp[idx]);
+      if (sum >= best) continue;
+      best = sum;
+      std::copy(temp.begin(), temp.end(), filtered);
+    }
+  }
+
+  bool make_image_png(const image_data& image, vector<byte>& png,
+      const png_params& params, string& error) {
+    if (image.width <= 0 || image.height <= 0) {
+      error = "cannot encode image";
       return false;
     }
 
+    // bands of about 256KB of pixels, converted to bytes, filtered and
+    // compressed in parallel
+    auto row_size = (size_t)image.width * 4;
+    auto rows     = (int)std::max((size_t)1, ((size_t)256 << 10) / row_size);
+    auto nbands   = (image.height + rows - 1) / rows;
+    auto bands    = vector<deflate_writer>(nbands);
+    auto adlers   = vector<uint32_t>(nbands);
+    auto sizes    = vector<size_t>(nbands);
+    auto encode   = [&](size_t band) {
+      auto start    = (int)band * rows;
+      auto end      = std::min(start + rows, image.height);
+      auto filtered = vector<byte>((end - start) * (row_size + 1));
+      // the current row and the one above, converted once each
+      auto buffer   = vector<byte>(row_size * 2);
+      auto get_row  = [&](int j) { return buffer.data() + (j % 2) * row_size; };
+      if (start > 0) make_image_row(image, start - 1, get_row(start - 1));
+      for (auto j = start; j < end; j++) {
+        auto row   = get_row(j);
+        auto above = j > 0 ? get_row(j - 1) : nullptr;
+        auto out   = filtered.data() + (j - start) * (row_size + 1);
+        make_image_row(image, j, row);
+        if (params.filter == png_filter::adaptive) {
+          filter_row(out, row, above, (int)row_size);
+        } else {
+          filter_row(out, row, above, (int)row_size, params.filter);
+        }
+      }
+      auto& writer = bands[band];
+      // the chunk header is written first, so that its crc covers it
+      writer.data.insert(writer.data.end(), {'I', 'D', 'A', 'T'});
+      if (band == 0) writer.data.insert(writer.data.end(), {0x78, 0x9c});
+      deflate_band(writer, filtered.data(), (int)filtered.size(),
+          params.level);
+      write_sync(writer);
+      adlers[band] = adler32(filtered.data(), filtered.size());
+      sizes[band]  = filtered.size();
+    };
+    if (params.noparallel) {
+      for (auto band = (size_t)0; band < bands.size(); band++) encode(band);
+    } else {
+      parallel_for(bands.size(), encode);
+    }
+
+    // header
+    png.clear();
+    png.insert(png.end(), {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'});
+    auto header = vector<byte>{};
+    write_uint32(header, (uint32_t)image.width);
+    write_uint32(header, (uint32_t)image.height);
+    header.insert(header.end(), {8, 6, 0, 0, 0});
+    write_chunk(png, "IHDR", header);
+
+    // a chunk per band, and the end of the stream in the last chunk
+    auto adler = adlers[0];
+    for (auto band = (size_t)1; band < bands.size(); band++)
+      adler = adler32_combine(adler, adlers[band], sizes[band]);
+    for (auto& band : bands) {
+      write_uint32(png, (uint32_t)band.data.size() - 4);
+      png.insert(png.end(), band.data.begin(), band.data.end());
+      write_uint32(png, crc32(band.data.data(), band.data.size()));
+    }
+    auto end = vector<byte>{0x03, 0x00};
+    write_uint32(end, adler);
+    write_chunk(png, "IDAT", end);
+    write_chunk(png, "IEND", {});
     return true;
   }
 
-  bool load_dgram(const string& filename, dgram_scenes& dgram, string& error) {
-    auto ext = path_extension(filename);
-    if (ext == ".json" || ext == ".JSON") {
-      return load_json_dgram(filename, dgram, error);
-    } else {
-      error = "unsupported format " + filename;
-      return false;
-    }
+  vector<byte> make_image_png(
+      const image_data& image, const png_params& params) {
+    auto error = string{};
+    auto png   = vector<byte>{};
+    if (!make_image_png(image, png, params, error)) throw io_error{error};
+    return png;
   }
 
-  dgram_scenes load_dgram(const string& filename) {
+  vector<byte> make_zlib(const vector<byte>& data, int level) {
+    auto writer = deflate_writer{};
+    writer.data.insert(writer.data.end(), {0x78, 0x9c});
+    deflate_band(writer, data.data(), (int)data.size(), level);
+    write_sync(writer);
+    writer.data.insert(writer.data.end(), {0x03, 0x00});
+    write_uint32(writer.data, adler32(data.data(), data.size()));
+    return std::move(writer.data);
+  }
+
+  bool save_image_png(const string& filename, const image_data& image,
+      const png_params& params, string& error) {
+    auto png = vector<byte>{};
+    if (!make_image_png(image, png, params, error)) return false;
+    return save_binary(filename, png, error);
+  }
+
+  void save_image_png(const string& filename, const image_data& image,
+      const png_params& params) {
     auto error = string{};
-    auto dgram = dgram_scenes{};
-    if (!load_dgram(filename, dgram, error)) throw io_error{error};
-    return dgram;
+    if (!save_image_png(filename, image, params, error)) throw io_error{error};
   }
 
 }  // namespace yocto
@@ -396,45 +1259,527 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  bool save_texts(const string& filename, const dgram_scenes& dgram,
-      const int res, string& error) {
-    if (!make_directory(
-            path_join(path_dirname(filename), "labels"), error, true))
+  // Rasterization request of a label, at the size of the cache
+  static text_request get_text_request(const dgram_scenes& dgram,
+      const dgram_scene& scene, const int object, const int j) {
+    auto size = get_text_size(dgram.size);
+    return make_text_request(scene, object, j, dgram.size, size.x, size.y);
+  }
+
+  // Cached distance field of a label
+  static string get_text_path(
+      const string& dirname, const text_request& request) {
+    return path_join(dirname, make_text_key(request) + ".sdf.png");
+  }
+
+  // Saves cached data under a temporary name, so that an interrupted run does
+  // not leave partial images in the cache
+  static bool save_cached(
+      const string& filename, const vector<byte>& data, string& error) {
+    auto temp = filename + ".tmp";
+    if (!save_binary(temp, data, error)) return false;
+    try {
+      std::filesystem::rename(make_path(temp), make_path(filename));
+      return true;
+    } catch (...) {
+      error = filename + ": cannot save label";
       return false;
+    }
+  }
+
+  // Requests the labels missing from the caches in a single batch. Labels
+  // cached at another resolution are requested again.
+  static bool save_texts(const vector<string>& dirnames,
+      const vector<const dgram_scenes*>& dgrams, const vector<int>& resolutions,
+      const text_client_params& params, string& error) {
+    auto requests = vector<text_request>{};
+    auto paths    = vector<string>{};
+    auto visited  = std::unordered_set<string>{};
+    for (auto idx = 0; idx < dgrams.size(); idx++) {
+      if (!make_directory(dirnames[idx], error)) return false;
+      auto& dgram = *dgrams[idx];
+      auto  size  = get_text_size(dgram.size, resolutions[idx]);
+      for (auto& scene : dgram.scenes) {
+        for (auto i = 0; i < scene.objects.size(); i++) {
+          auto& object = scene.objects[i];
+          if (object.labels == -1) continue;
+          auto& label = scene.labels[object.labels];
+          for (auto j = 0; j < label.texts.size(); j++) {
+            // plain text is rasterized in-process
+            if (is_plain_text(label.texts[j])) continue;
+            auto path = get_text_path(
+                dirnames[idx], get_text_request(dgram, scene, i, j));
+            if (!visited.insert(path).second) continue;
+            auto cached = vec2i{0, 0};
+            if (get_label_size(path, cached) && cached.x == size.x * 2)
+              continue;
+            requests.push_back(
+                make_text_request(scene, i, j, dgram.size, size.x, size.y));
+            paths.push_back(path);
+          }
+        }
+      }
+    }
+
+    // images are saved as distance fields as they arrive
+    return make_text_pngs(
+        requests,
+        [&](int idx, const vector<byte>& png, string& error) {
+          auto sdf = vector<byte>{};
+          return make_label_sdf(png, sdf, error) &&
+                 save_cached(paths[idx], sdf, error);
+        },
+        params, error);
+  }
+
+  bool save_texts(const string& dirname, const dgram_scenes& dgram,
+      const int res, const text_client_params& params, string& error) {
+    return save_texts(vector<string>{dirname},
+        vector<const dgram_scenes*>{&dgram}, vector<int>{res}, params, error);
+  }
 
-    auto aspect = dgram.size.x / dgram.size.y;
-    auto width  = res;
-    auto height = (int)round(res / aspect);
-    if (aspect < 1) swap(width, height);
+  void save_texts(const string& dirname, const dgram_scenes& dgram,
+      const int res, const text_client_params& params) {
+    auto error = string{};
+    if (!save_texts(dirname, dgram, res, params, error))
+      throw io_error{error};
+  }
+
+  bool save_texts(const vector<string>& dirnames,
+      const vector<dgram_scenes>& dgrams, const vector<int>& resolutions,
+      const text_client_params& params, string& error) {
+    auto pointers = vector<const dgram_scenes*>{};
+    for (auto& dgram : dgrams) pointers.push_back(&dgram);
+    return save_texts(dirnames, pointers, resolutions, params, error);
+  }
 
+  void save_texts(const vector<string>& dirnames,
+      const vector<dgram_scenes>& dgrams, const vector<int>& resolutions,
+      const text_client_params& params) {
+    auto error = string{};
+    if (!save_texts(dirnames, dgrams, resolutions, params, error))
+      throw io_error{error};
+  }
+
+  bool load_texts(const string& dirname, dgram_scenes& dgram,
+      vector<string>& warnings, string& error, bool noparallel) {
+    // objects sharing an image are collected first, so that each file is
+    // decoded once
+    auto paths  = vector<string>{};
+    auto keys   = vector<string>{};
+    auto users  = vector<vector<dgram_label_image*>>{};
+    auto lookup = std::unordered_map<string, int>{};
+    auto add    = [&](const text_request& request, dgram_label_image* user) {
+      auto path = get_text_path(dirname, request);
+      if (!path_exists(path)) return;
+      auto [it, inserted] = lookup.insert({path, (int)paths.size()});
+      if (inserted) {
+        paths.push_back(path);
+        keys.push_back(make_text_key(request));
+        users.emplace_back();
+      }
+      users[it->second].push_back(user);
+    };
     for (auto& scene : dgram.scenes) {
-      auto images = make_text_images(
-          scene, dgram.size, dgram.scale, width, height);
-      for (auto& image : images.images) {
-        auto name = image.name + ".png";
-        auto path = path_join(path_dirname(filename), "labels", name);
-
-        if (name.length() > 255) {
-          error = "cannot create label " + path + ", filename too long";
-          return false;
+      update_label_images(scene);
+      for (auto i = 0; i < scene.objects.size(); i++) {
+        auto& object = scene.objects[i];
+        if (object.labels == -1) continue;
+        auto& label = scene.labels[object.labels];
+        for (auto j = 0; j < label.texts.size(); j++) {
+          if (is_plain_text(label.texts[j])) continue;
+          add(get_text_request(dgram, scene, i, j), &object.fields[j]);
         }
+      }
+    }
 
-        if (path_exists(path)) {
-          error = "cannot create label " + path +
-                  ", another label with the same name already exists";
-          return false;
-        }
+    // decode the images, each in its own slot
+    auto images = vector<dgram_label_image>(paths.size());
+    auto errors = vector<string>(paths.size());
+    auto decode = [&](size_t idx) {
+      if (!load_label_sdf(paths[idx], images[idx], errors[idx])) return;
+      images[idx].key = keys[idx];
+    };
+    if (noparallel) {
+      for (auto idx = (size_t)0; idx < paths.size(); idx++) decode(idx);
+    } else {
+      parallel_for(paths.size(), decode);
+    }
+
+    // images are assigned after decoding; unreadable ones are skipped
+    for (auto idx = (size_t)0; idx < paths.size(); idx++) {
+      if (!errors[idx].empty()) {
+        warnings.push_back(errors[idx]);
+        continue;
+      }
+      for (auto user : users[idx]) *user = images[idx];
+    }
+    return true;
+  }
+
+  vector<string> load_texts(
+      const string& dirname, dgram_scenes& dgram, bool noparallel) {
+    auto warnings = vector<string>{};
+    auto error    = string{};
+    if (!load_texts(dirname, dgram, warnings, error, noparallel))
+      throw io_error{error};
+    return warnings;
+  }
+
+}  // namespace yocto
+// -----------------------------------------------------------------------------
+// DGRAM BUNDLES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Bundles start with a signature and a version, that must be increased
+  // whenever the format or the way scenes are built changes
+  static const auto bundle_signature = string{"dgram bundle"};
+  static const auto bundle_version   = (uint32_t)3;
+
+  // Values are written as their bytes, and arrays are preceded by their size
+  template <typename T>
+  static void write_value(vector<byte>& data, const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>, "cannot write value");
+    auto bytes = (const byte*)&value;
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+  static void write_value(vector<byte>& data, const string& value) {
+    write_value(data, (uint64_t)value.size());
+    data.insert(data.end(), value.begin(), value.end());
+  }
+  template <typename T>
+  static void write_values(vector<byte>& data, const T* values, size_t count) {
+    write_value(data, (uint64_t)count);
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      auto bytes = (const byte*)values;
+      data.insert(data.end(), bytes, bytes + count * sizeof(T));
+    } else {
+      for (auto idx = (size_t)0; idx < count; idx++)
+        write_value(data, values[idx]);
+    }
+  }
+  template <typename T>
+  static void write_value(vector<byte>& data, const vector<T>& values) {
+    write_values(data, values.data(), values.size());
+  }
+  template <typename T>
+  static void write_value(vector<byte>& data, const shape_view<T>& values) {
+    write_values(data, values.data, values.count);
+  }
+
+  // Values are read from a mapped file, checking its bounds
+  struct bundle_stream {
+    const byte* data = nullptr;
+    size_t      size = 0;
+  };
+
+  template <typename T>
+  [[nodiscard]] static bool read_value(bundle_stream& stream, T& value) {
+    static_assert(std::is_trivially_copyable_v<T>, "cannot read value");
+    if (stream.size < sizeof(T)) return false;
+    memcpy(&value, stream.data, sizeof(T));
+    stream.data += sizeof(T);
+    stream.size -= sizeof(T);
+    return true;
+  }
+  [[nodiscard]] static bool read_value(bundle_stream& stream, string& value) {
+    auto count = (uint64_t)0;
+    if (!read_value(stream, count) || count > stream.size) return false;
+    value.assign((const char*)stream.data, (size_t)count);
+    stream.data += count;
+    stream.size -= count;
+    return true;
+  }
+  template <typename T>
+  [[nodiscard]] static bool read_value(
+      bundle_stream& stream, vector<T>& values) {
+    auto count = (uint64_t)0;
+    if (!read_value(stream, count)) return false;
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      if (count > stream.size / sizeof(T)) return false;
+      values.resize((size_t)count);
+      if (count != 0) memcpy(values.data(), stream.data, count * sizeof(T));
+      stream.data += count * sizeof(T);
+      stream.size -= count * sizeof(T);
+    } else {
+      if (count > stream.size) return false;
+      values.resize((size_t)count);
+      for (auto& value : values)
+        if (!read_value(stream, value)) return false;
+    }
+    return true;
+  }
+  template <typename T>
+  [[nodiscard]] static bool read_value(
+      bundle_stream& stream, shape_view<T>& view) {
+    auto values = vector<T>{};
+    if (!read_value(stream, values)) return false;
+    view = values.empty() ? shape_view<T>{} : own_view(std::move(values));
+    return true;
+  }
+
+  // Diagram content, written only to be hashed. Label images are not part of
+  // the diagram, and shape borders are derived from its faces.
+  static void write_value(vector<byte>& data, const dgram_shape& shape) {
+    write_value(data, shape.positions);
+    write_value(data, shape.points);
+    write_value(data, shape.lines);
+    write_value(data, shape.triangles);
+    write_value(data, shape.quads);
+    write_value(data, shape.fills);
+    write_value(data, shape.ends);
+    write_value(data, shape.cull);
+    write_value(data, shape.boundary);
+  }
+  static void write_value(vector<byte>& data, const dgram_object& object) {
+    write_value(data, object.frame);
+    write_value(data, object.shape);
+    write_value(data, object.material);
+    write_value(data, object.labels);
+  }
+  static void write_value(vector<byte>& data, const dgram_label& label) {
+    write_value(data, label.names);
+    write_value(data, label.positions);
+    write_value(data, label.texts);
+    write_value(data, label.offsets);
+    write_value(data, label.alignments);
+  }
+  static void write_value(vector<byte>& data, const dgram_scene& scene) {
+    write_value(data, scene.offset);
+    write_value(data, scene.cameras);
+    write_value(data, scene.objects);
+    write_value(data, scene.materials);
+    write_value(data, scene.shapes);
+    write_value(data, scene.labels);
+  }
+
+  // Scene bundles
+  static void write_value(vector<byte>& data, const trace_shape& shape) {
+    write_value(data, shape.positions);
+    write_value(data, shape.points);
+    write_value(data, shape.lines);
+    write_value(data, shape.triangles);
+    write_value(data, shape.quads);
+    write_value(data, shape.borders);
+    write_value(data, shape.fills);
+    write_value(data, shape.ends);
+    write_value(data, shape.radius);
+    write_value(data, shape.radii);
+    write_value(data, shape.arrow_ids);
+    write_value(data, shape.arrows);
+    write_value(data, shape.line_offsets);
+    write_value(data, shape.border_offsets);
+    write_value(data, shape.material);
+  }
+  [[nodiscard]] static bool read_value(
+      bundle_stream& stream, trace_shape& shape) {
+    return read_value(stream, shape.positions) &&
+           read_value(stream, shape.points) &&
+           read_value(stream, shape.lines) &&
+           read_value(stream, shape.triangles) &&
+           read_value(stream, shape.quads) &&
+           read_value(stream, shape.borders) &&
+           read_value(stream, shape.fills) &&
+           read_value(stream, shape.ends) &&
+           read_value(stream, shape.radius) &&
+           read_value(stream, shape.radii) &&
+           read_value(stream, shape.arrow_ids) &&
+           read_value(stream, shape.arrows) &&
+           read_value(stream, shape.line_offsets) &&
+           read_value(stream, shape.border_offsets) &&
+           read_value(stream, shape.material);
+  }
+
+  static void write_value(vector<byte>& data, const dgram_shape_bvh& bvh) {
+    write_value(data, bvh.nodes);
+    write_value(data, bvh.primitives);
+  }
+  [[nodiscard]] static bool read_value(
+      bundle_stream& stream, dgram_shape_bvh& bvh) {
+    return read_value(stream, bvh.nodes) && read_value(stream, bvh.primitives);
+  }
+
+  static void write_value(vector<byte>& data, const trace_text& text) {
+    write_value(data, text.name);
+    write_value(data, text.object);
+    write_value(data, text.index);
+    write_value(data, text.positions);
+    write_value(data, text.page);
+    write_value(data, text.min);
+    write_value(data, text.size);
+    write_value(data, text.sdf);
+    write_value(data, text.sdf_scale);
+  }
+  [[nodiscard]] static bool read_value(
+      bundle_stream& stream, trace_text& text) {
+    return read_value(stream, text.name) && read_value(stream, text.object) &&
+           read_value(stream, text.index) &&
+           read_value(stream, text.positions) &&
+           read_value(stream, text.page) && read_value(stream, text.min) &&
+           read_value(stream, text.size) &&
+           read_value(stream, text.sdf) && read_value(stream, text.sdf_scale);
+  }
+
+  static void write_value(vector<byte>& data, const dgram_atlas_page& page) {
+    write_value(data, page.width);
+    write_value(data, page.height);
+    write_value(data, *page.pixels);
+  }
+  [[nodiscard]] static bool read_value(
+      bundle_stream& stream, dgram_atlas_page& page) {
+    auto pixels = vector<vec4b>{};
+    if (!read_value(stream, page.width) || !read_value(stream, page.height) ||
+        !read_value(stream, pixels))
+      return false;
+    page.pixels = std::make_shared<const vector<vec4b>>(std::move(pixels));
+    return true;
+  }
+
+  static void write_value(
+      vector<byte>& data, const dgram_scene_bundle& scene) {
+    write_value(data, scene.shapes.shapes);
+    write_value(data, scene.bvh.nodes);
+    write_value(data, scene.bvh.primitives);
+    write_value(data, scene.bvh.shapes);
+    write_value(data, scene.texts.texts);
+    write_value(data, scene.texts.pages);
+  }
+  [[nodiscard]] static bool read_value(
+      bundle_stream& stream, dgram_scene_bundle& scene) {
+    return read_value(stream, scene.shapes.shapes) &&
+           read_value(stream, scene.bvh.nodes) &&
+           read_value(stream, scene.bvh.primitives) &&
+           read_value(stream, scene.bvh.shapes) &&
+           read_value(stream, scene.texts.texts) &&
+           read_value(stream, scene.texts.pages);
+  }
 
-        if (!save_image(path, image.image, error)) return false;
+  // Cached label images are named by their content, so only the labels
+  // found in the cache matter, with the resolution they were made at
+  static void write_cached_labels(vector<byte>& data,
+      const dgram_scenes& dgram, const dgram_scene& scene,
+      const string& dirname) {
+    for (auto i = 0; i < scene.objects.size(); i++) {
+      auto& object = scene.objects[i];
+      if (object.labels == -1) continue;
+      auto& label = scene.labels[object.labels];
+      for (auto j = 0; j < label.texts.size(); j++) {
+        if (is_plain_text(label.texts[j])) continue;
+        auto request = get_text_request(dgram, scene, i, j);
+        auto size    = vec2i{0, 0};
+        get_label_size(get_text_path(dirname, request), size);
+        write_value(data, size);
       }
     }
+  }
+
+  // 64-bit FNV-1a of the content
+  static string make_content_key(const vector<byte>& data) {
+    auto hash = (uint64_t)14695981039346656037ull;
+    for (auto c : data) {
+      hash ^= (uint8_t)c;
+      hash *= (uint64_t)1099511628211ull;
+    }
+    auto stream = std::ostringstream{};
+    stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return stream.str();
+  }
+
+  string make_bundle_key(const dgram_scenes& dgram, const string& dirname,
+      int camera, int width, int height, bool highquality) {
+    auto data = vector<byte>{};
+    write_value(data, dgram.size);
+    write_value(data, dgram.scale);
+    write_value(data, dgram.scenes);
+    write_value(data, camera);
+    write_value(data, width);
+    write_value(data, height);
+    write_value(data, highquality);
+    for (auto& scene : dgram.scenes)
+      write_cached_labels(data, dgram, scene, dirname);
+    return make_content_key(data);
+  }
+
+  string make_labels_key(const dgram_scenes& dgram, const string& dirname) {
+    auto data = vector<byte>{};
+    write_value(data, dirname);
+    for (auto& scene : dgram.scenes)
+      write_cached_labels(data, dgram, scene, dirname);
+    return make_content_key(data);
+  }
+
+  string make_scene_key(const dgram_scenes& dgram, int scene,
+      const string& dirname, int camera, int width, int height,
+      bool highquality) {
+    auto data = vector<byte>{};
+    write_value(data, dgram.size);
+    write_value(data, dgram.scale);
+    write_value(data, dgram.scenes[scene]);
+    write_value(data, camera);
+    write_value(data, width);
+    write_value(data, height);
+    write_value(data, highquality);
+    write_cached_labels(data, dgram, dgram.scenes[scene], dirname);
+    return make_content_key(data);
+  }
+
+  bool load_bundle(
+      const string& filename, dgram_bundle& bundle, string& error) {
+    auto file = mapped_file{};
+    if (!map_file(filename, file, error)) return false;
+    auto stream    = bundle_stream{file.data, file.size};
+    auto signature = string(bundle_signature.size(), ' ');
+    for (auto& c : signature) {
+      if (!read_value(stream, c)) break;
+    }
+    auto version = (uint32_t)0;
+    if (signature != bundle_signature || !read_value(stream, version)) {
+      error = filename + ": not a bundle";
+      return false;
+    }
+    if (version != bundle_version) {
+      error = filename + ": unsupported bundle version";
+      return false;
+    }
+    if (!read_value(stream, bundle.key) ||
+        !read_value(stream, bundle.scenes) || stream.size != 0) {
+      error = "cannot parse " + filename;
+      return false;
+    }
     return true;
   }
 
-  void save_texts(
-      const string& filename, const dgram_scenes& dgram, const int res) {
+  bool save_bundle(
+      const string& filename, const dgram_bundle& bundle, string& error) {
+    auto data = vector<byte>{};
+    data.insert(data.end(), bundle_signature.begin(), bundle_signature.end());
+    write_value(data, bundle_version);
+    write_value(data, bundle.key);
+    write_value(data, bundle.scenes);
+
+    // saved under a temporary name, so that readers never see partial files
+    auto temp = filename + ".tmp";
+    if (!save_binary(temp, data, error)) return false;
+    try {
+      std::filesystem::rename(make_path(temp), make_path(filename));
+      return true;
+    } catch (...) {
+      error = filename + ": cannot save bundle";
+      return false;
+    }
+  }
+
+  dgram_bundle load_bundle(const string& filename) {
+    auto error  = string{};
+    auto bundle = dgram_bundle{};
+    if (!load_bundle(filename, bundle, error)) throw io_error{error};
+    return bundle;
+  }
+
+  void save_bundle(const string& filename, const dgram_bundle& bundle) {
     auto error = string{};
-    if (!save_texts(filename, dgram, res, error)) throw io_error{error};
+    if (!save_bundle(filename, bundle, error)) throw io_error{error};
   }
 
-}  // namespace yocto
\ No newline at end of file
+}  // namespace yocto
@@ -36,7 +36,10 @@
 #include <yocto/yocto_sceneio.h>
 
 #include "yocto_dgram.h"
+#include "yocto_dgram_bvh.h"
+#include "yocto_dgram_shape.h"
 #include "yocto_dgram_text.h"
+#include "yocto_dgram_trace.h"
 
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
@@ -55,6 +58,55 @@ namespace yocto {
   bool load_dgram(const string& filename, dgram_scenes& dgram, string& error);
   dgram_scenes load_dgram(const string& filename);
 
+  // Parses a diagram from its json text, with binary buffers relative to a
+  // directory. Buffers outside of the directory are rejected.
+  bool parse_dgram(const string& text, dgram_scenes& dgram, string& error,
+      const string& dirname = "");
+  dgram_scenes parse_dgram(const string& text, const string& dirname = "");
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// DGRAM IMAGES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Converts a rendered image to 8-bit sRGB pixels
+  vector<vec4b> make_image_bytes(const image_data& image);
+
+  // PNG row filters; adaptive picks the best filter for each row
+  enum struct png_filter { adaptive, none, sub, up, average, paeth };
+
+  // PNG encoding options. Levels go from 0, that stores the pixels, to 9;
+  // level 1 with the up filter is a fast mode for previews.
+  struct png_params {
+    int        level      = 6;
+    png_filter filter     = png_filter::adaptive;
+    bool       noparallel = false;
+  };
+
+  // Encodes a rendered image as PNG data. Bands of rows are compressed in
+  // parallel, as independent blocks of a single stream.
+  bool make_image_png(const image_data& image, vector<byte>& png,
+      const png_params& params, string& error);
+  vector<byte> make_image_png(
+      const image_data& image, const png_params& params = {});
+
+  // Saves a rendered image as PNG
+  bool save_image_png(const string& filename, const image_data& image,
+      const png_params& params, string& error);
+  void save_image_png(const string& filename, const image_data& image,
+      const png_params& params = {});
+
+  // Compresses data as a zlib stream, with the encoder of PNG images
+  vector<byte> make_zlib(const vector<byte>& data, int level = 6);
+
+  // png filter labels
+  inline const auto png_filter_labels = vector<pair<png_filter, string>>{
+      {png_filter::adaptive, "adaptive"}, {png_filter::none, "none"},
+      {png_filter::sub, "sub"}, {png_filter::up, "up"},
+      {png_filter::average, "average"}, {png_filter::paeth, "paeth"}};
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -62,10 +114,73 @@ namespace yocto {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-  bool save_texts(const string& filename, const dgram_scenes& dgram,
-      const int res, string& error);
-  void save_texts(
-      const string& filename, const dgram_scenes& dgram, const int res);
+  // Label images are cached in a directory, named by their key, as distance
+  // fields that serve every resolution. They are made at a resolution, by
+  // default the one of the renderer, and made again if cached at another one.
+  // The cache is shared by all diagrams and only missing images are
+  // rasterized when saving. Plain text labels are skipped, since they are
+  // rasterized in-process. Other labels without a cached image keep a
+  // placeholder.
+  bool save_texts(const string& dirname, const dgram_scenes& dgram,
+      const int res, const text_client_params& params, string& error);
+  void save_texts(const string& dirname, const dgram_scenes& dgram,
+      const int res, const text_client_params& params = {});
+
+  // Saves the labels of many diagrams, each in its own directory, with the
+  // requests for all of them sent concurrently
+  bool save_texts(const vector<string>& dirnames,
+      const vector<dgram_scenes>& dgrams, const vector<int>& resolutions,
+      const text_client_params& params, string& error);
+  void save_texts(const vector<string>& dirnames,
+      const vector<dgram_scenes>& dgrams, const vector<int>& resolutions,
+      const text_client_params& params = {});
+
+  // Loads the cached images of the labels, decoding them in parallel. Only
+  // the label images are written, so that the other parts of the diagram can
+  // be used while loading. Unreadable images are skipped, leaving their
+  // labels with the placeholder, and their errors are returned as warnings.
+  bool load_texts(const string& dirname, dgram_scenes& dgram,
+      vector<string>& warnings, string& error, bool noparallel = false);
+  vector<string> load_texts(
+      const string& dirname, dgram_scenes& dgram, bool noparallel = false);
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// DGRAM BUNDLES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+  // Precompiled scenes of a diagram, that can be rendered without building
+  // them again. They are valid only for the key they were built for.
+  struct dgram_bundle {
+    string                     key    = "";
+    vector<dgram_scene_bundle> scenes = {};
+  };
+
+  // Key of the bundle of a diagram, hashed from its content, the camera, the
+  // image size, the bvh quality and the labels found in the cache directory
+  string make_bundle_key(const dgram_scenes& dgram, const string& dirname,
+      int camera, int width, int height, bool highquality);
+
+  // Key of the labels of a diagram found in the cache directory, that changes
+  // when they are added or made again
+  string make_labels_key(const dgram_scenes& dgram, const string& dirname);
+
+  // Key of a single scene of a diagram, hashed as the bundle key, that tells
+  // which scenes changed between two versions of a diagram
+  string make_scene_key(const dgram_scenes& dgram, int scene,
+      const string& dirname, int camera, int width, int height,
+      bool highquality);
+
+  // Load/save bundles, stored in a versioned binary format. Bundles are
+  // memory-mapped when loading. Bundles from other versions fail to load.
+  bool load_bundle(
+      const string& filename, dgram_bundle& bundle, string& error);
+  bool save_bundle(
+      const string& filename, const dgram_bundle& bundle, string& error);
+  dgram_bundle load_bundle(const string& filename);
+  void         save_bundle(const string& filename, const dgram_bundle& bundle);
 
 }  // namespace yocto
 
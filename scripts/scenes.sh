@@ -1,8 +1 @@
-for folder in scenes/*
-do
-    for scene in "$folder"/*
-    do
-        scene_name="$(basename -- $scene)"
-        ./bin/dgram render --scene "${scene}/${scene_name}.json" --output out/${scene//\//__}.png
-    done
-done
\ No newline at end of file
+./bin/dgram batch --scenes scenes --output out